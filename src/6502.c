@@ -30,6 +30,7 @@
 #include "label.h"
 #include "parse.h"
 #include "cmd.h"
+#include "hash.h"
 #include "codepage.h"
 
 #include "6502.h"
@@ -2193,13 +2194,84 @@ static const HandlerTable undocumented_handler_table[] =
 
 
 
+/* ---------------------------------------- OPCODE INDEX
+*/
+
+/* The opcode tables are indexed by name the first time the CPU is
+   initialised.  Only one of the table pointers is set for each name.
+*/
+typedef struct
+{
+    const OpcodeTable    *implied;
+    const OpcodeTable    *branch;
+    const HandlerTable   *handler;
+} OpcodeIndex;
+
+static HashTable        *opcode_index;
+
+
+/* Adds an opcode to the index.  Names already indexed are left alone, so the
+   tables are added in the order they used to be searched in.
+*/
+static void AddOpcode(const char *op, const OpcodeTable *implied,
+                      const OpcodeTable *branch, const HandlerTable *handler)
+{
+    OpcodeIndex *i;
+
+    if (HashFind(opcode_index, op))
+    {
+        return;
+    }
+
+    i = Malloc(sizeof *i);
+    i->implied = implied;
+    i->branch = branch;
+    i->handler = handler;
+
+    HashAdd(opcode_index, op, i);
+}
+
+
+static void IndexOpcodes(void)
+{
+    int f;
+
+    opcode_index = HashCreate();
+
+    for(f = 0; implied_opcodes[f].op; f++)
+    {
+        AddOpcode(implied_opcodes[f].op, implied_opcodes + f, NULL, NULL);
+    }
+
+    for(f = 0; branch_opcodes[f].op; f++)
+    {
+        AddOpcode(branch_opcodes[f].op, NULL, branch_opcodes + f, NULL);
+    }
+
+    for(f = 0; handler_table[f].op; f++)
+    {
+        AddOpcode(handler_table[f].op, NULL, NULL, handler_table + f);
+    }
+
+    for(f = 0; undocumented_handler_table[f].op; f++)
+    {
+        AddOpcode(undocumented_handler_table[f].op,
+                  NULL, NULL, undocumented_handler_table + f);
+    }
+}
+
+
 /* ---------------------------------------- PUBLIC FUNCTIONS
 */
 
 void Init_6502(void)
 {
+    if (!opcode_index)
+    {
+        IndexOpcodes();
+    }
+
     option.zp_mode = ZP_AUTO;
-    SetNeededPasses(3);
 }
 
 
@@ -2232,69 +2304,53 @@ CommandStatus SetOption_6502(int opt, int argc, char *argv[],
 CommandStatus Handler_6502(const char *label, int argc, char *argv[],       
                            int quoted[], char *err, size_t errsize)
 {
-    int f;
+    const OpcodeIndex *op = HashFind(opcode_index, argv[0]);
+
+    if (!op)
+    {
+        return CMD_NOT_KNOWN;
+    }
 
     /* Check for simple (implied addressing) opcodes
     */
-    for(f = 0; implied_opcodes[f].op; f++)
+    if (op->implied)
     {
-        if (CompareString(argv[0], implied_opcodes[f].op))
-        {
-            PCWrite(implied_opcodes[f].code);
-            return CMD_OK;
-        }
+        PCWrite(op->implied->code);
+        return CMD_OK;
     }
 
     /* Check for branch opcodes
     */
-    for(f = 0; branch_opcodes[f].op; f++)
+    if (op->branch)
     {
-        if (CompareString(argv[0], branch_opcodes[f].op))
-        {
-            long offset;
+        long offset;
 
-            CMD_ARGC_CHECK(2);
+        CMD_ARGC_CHECK(2);
 
-            CMD_EXPR(argv[1], offset);
+        CMD_EXPR(argv[1], offset);
 
-            offset = offset - (PC() + 2);
+        offset = offset - (PC() + 2);
 
-            if (IsFinalPass() && (offset < -128 || offset > 127))
-            {
-                snprintf(err, errsize, "%s: Branch offset (%ld) too big",
-                                            argv[1], offset);
-                return CMD_FAILED;
-            }
-
-            PCWrite(branch_opcodes[f].code);
-            PCWrite(offset);
-
-            return CMD_OK;
+        if (IsFinalPass() && (offset < -128 || offset > 127))
+        {
+            snprintf(err, errsize, "%s: Branch offset (%ld) too big",
+                                        argv[1], offset);
+            return CMD_FAILED;
         }
-    }
 
+        PCWrite(op->branch->code);
+        PCWrite(offset);
 
-    /* Check for legal opcodes
-    */
-    for(f = 0; handler_table[f].op; f++)
-    {
-        if (CompareString(argv[0], handler_table[f].op))
-        {
-            return handler_table[f].cmd(label, argc, argv,
-                                        quoted, err, errsize);;
-        }
+        return CMD_OK;
     }
 
 
-    /* Check for undocumented opcodes
+    /* Check for legal and undocumented opcodes
     */
-    for(f = 0; undocumented_handler_table[f].op; f++)
+    if (op->handler)
     {
-        if (CompareString(argv[0], undocumented_handler_table[f].op))
-        {
-            return undocumented_handler_table[f].cmd(label, argc, argv,
-                                                     quoted, err, errsize);;
-        }
+        return op->handler->cmd(label, argc, argv,
+                                quoted, err, errsize);;
     }
 
 
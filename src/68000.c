@@ -2199,7 +2199,6 @@ static const HandlerTable undocumented_handler_table[] =
 void Init_68000(void)
 {
     option.zp_mode = ZP_AUTO;
-    SetNeededPasses(3);
 }
 
 
@@ -28,102 +28,136 @@
 #include <ctype.h>
 
 #include "global.h"
+#include "hash.h"
 #include "alias.h"
 
 
 /* ---------------------------------------- TYPES
 */
 
+/* Aliases aren't thrown away between passes.  Each definition is kept in a
+   history in the order the pass made it, and a pass starts by rewinding to
+   the start of the history.  Definitions that repeat those made at the same
+   point last pass just move along it, so the aliases in force at any line
+   are identified by a position in the history that's the same each pass.
+*/
+typedef struct
+{
+    unsigned            id;
+    char                *command;
+    char                *alias;
+} Definition;
+
 typedef struct alias
 {
     char                *command;
     char                *alias;
+    int                 defined;
     struct alias        *next;
 } Alias;
 
 
 /* ---------------------------------------- GLOBALS
 */
-static Alias    *head;
-static Alias    *tail;
+static Alias            *head;
+
+/* Aliases indexed by command, as every line looks for one
+*/
+static HashTable        *by_name;
+
+static Definition       *history;
+static int              no_history;
+static int              history_size;
+static int              cursor;
+static unsigned         next_id;
 
 
 /* ---------------------------------------- PRIVATE FUNCTIONS INTERFACES
 */
 static Alias *FindAlias(const char *p)
 {
-    Alias *a = head;
-
-    while(a)
-    {
-        if (CompareString(a->command, p))
-        {
-            return a;
-        }
-
-        a = a->next;
-    }
-
-    return NULL;
+    return by_name ? HashFind(by_name, p) : NULL;
 }
 
 
-static void AddAlias(const char *p, const char *r)
+/* Put a definition in force
+*/
+static void Apply(const Definition *d)
 {
-    Alias *a = FindAlias(p);
+    Alias *a = FindAlias(d->command);
 
     if (!a)
     {
         a = Malloc(sizeof *a);
 
-        a->command = DupStr(p);
-        a->alias = DupStr(r);
-        a->next = NULL;
+        a->command = DupStr(d->command);
+        a->next = head;
+        head = a;
 
-        if (tail)
+        if (!by_name)
         {
-            tail->next = a;
+            by_name = HashCreate();
         }
 
-        tail = a;
-
-        if (!head)
-        {
-            head = a;
-        }
-    }
-    else
-    {
-        free(a->alias);
-        a->alias = DupStr(r);
+        HashAdd(by_name, a->command, a);
     }
+
+    a->alias = d->alias;
+    a->defined = TRUE;
 }
 
 
 /* ---------------------------------------- INTERFACES
 */
 
-void AliasClear()
+void AliasRewind(void)
 {
-    while(head)
-    {
-        Alias *a;
+    Alias *a;
 
-        free(head->command);
-        free(head->alias);
-        a = head;
-        head = head->next;
-        free(a);
+    for(a = head; a; a = a->next)
+    {
+        a->defined = FALSE;
     }
 
-    head = NULL;
-    tail = NULL;
+    cursor = 0;
 }
 
 
 void AliasCreate(const char *command, const char *alias)
 {
-    AddAlias(command, alias);
+    Definition *d;
+
+    if (cursor < no_history &&
+            CompareString(history[cursor].command, command) &&
+            strcmp(history[cursor].alias, alias) == 0)
+    {
+        Apply(history + cursor++);
+        return;
+    }
+
+    /* The pass has gone differently from the last, so what was defined
+       after this point last time no longer applies.  The ids are never
+       reused, so nothing can mistake the new definitions for the old.
+    */
+    while(no_history > cursor)
+    {
+        no_history--;
+        free(history[no_history].command);
+        free(history[no_history].alias);
+    }
+
+    if (no_history == history_size)
+    {
+        history_size = history_size ? history_size * 2 : 16;
+        history = Realloc(history, (sizeof *history) * history_size);
+    }
+
+    d = history + no_history++;
+    d->id = ++next_id;
+    d->command = DupStr(command);
+    d->alias = DupStr(alias);
+
+    Apply(history + cursor++);
 }
 
 
@@ -131,16 +165,21 @@ char *AliasExpand(char *command)
 {
     Alias *a;
 
-    if ((a = FindAlias(command)))
+    if ((a = FindAlias(command)) && a->defined)
     {
-        free(command);
-        command = DupStr(a->alias);
+        return a->alias;
     }
 
     return command;
 }
 
 
+unsigned AliasGeneration(void)
+{
+    return cursor ? history[cursor - 1].id : 0;
+}
+
+
 /*
 vim: ai sw=4 ts=8 expandtab
 */
@@ -31,20 +31,28 @@
 /* ---------------------------------------- INTERFACES
 */
 
-/* Clear all aliases
+/* Start a new pass.  No aliases are defined until they're created again,
+   though what was created last pass is kept so that it needn't be.
 */
-void    AliasClear();
+void    AliasRewind(void);
 
 /* Create an alias
 */
 void    AliasCreate(const char *command, const char *alias);
 
 /* Expand an alias.  The passed pointer is returned if there is no alias for
-   the command, otherwise if there is an alias the passed pointer is freed
-   and a newly allocated version of the replacement is returned.
+   the command, otherwise the replacement is returned.  The replacement is
+   owned by the alias and must not be altered or freed.
 */
 char    *AliasExpand(char *command);
 
+/* Get a number that changes whenever the aliases change, so that anything
+   worked out from an expanded alias can tell whether it is still valid.  If
+   a pass creates the same aliases as the last, the numbers seen at each point
+   in it are the same too.
+*/
+unsigned AliasGeneration(void);
+
 #endif
 
 /*
@@ -0,0 +1,219 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Region allocators.  Memory is handed out from a chain of blocks.
+    Resetting an arena rewinds it to the first block, keeping the chain so a
+    reused arena settles down to not needing the system allocator at all.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "arena.h"
+
+
+/* ---------------------------------------- TYPES
+*/
+
+#define BLOCK_SIZE      65536
+
+/* Allocations are rounded up to a multiple of this to keep them aligned
+*/
+typedef union
+{
+    long        l;
+    double      d;
+    void        *p;
+} Align;
+
+#define ALIGNED(n)      (((n) + sizeof(Align) - 1) / sizeof(Align) * sizeof(Align))
+
+typedef struct block
+{
+    size_t              size;
+    size_t              used;
+    struct block        *next;
+    Align               data[1];
+} Block;
+
+struct arena
+{
+    Block               *first;
+    Block               *current;
+};
+
+
+/* ---------------------------------------- GLOBALS
+*/
+static Arena            *line_arena;
+static Arena            *pass_arena;
+static Arena            *permanent_arena;
+
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+static Block *NewBlock(size_t size)
+{
+    Block *b;
+
+    b = Malloc(sizeof *b + size);
+    b->size = size;
+    b->used = 0;
+    b->next = NULL;
+
+    return b;
+}
+
+
+/* ---------------------------------------- INTERFACES
+*/
+Arena *ArenaCreate(void)
+{
+    Arena *a;
+
+    a = Malloc(sizeof *a);
+    a->first = NULL;
+    a->current = NULL;
+
+    return a;
+}
+
+
+void *ArenaAlloc(Arena *arena, size_t len)
+{
+    Block *b = arena->current;
+    void *p;
+
+    len = ALIGNED(len ? len : 1);
+
+    /* Move onto the next kept block, or add a new one, when this one is full.
+       Allocations too big for a normal block get one to themselves.
+    */
+    while(!b || b->size - b->used < len)
+    {
+        if (b && b->next)
+        {
+            b = b->next;
+            b->used = 0;
+        }
+        else
+        {
+            Block *n = NewBlock(len > BLOCK_SIZE ? len : BLOCK_SIZE);
+
+            if (b)
+            {
+                n->next = b->next;
+                b->next = n;
+            }
+            else
+            {
+                arena->first = n;
+            }
+
+            b = n;
+        }
+    }
+
+    arena->current = b;
+
+    p = (char *)b->data + b->used;
+    b->used += len;
+
+    return p;
+}
+
+
+char *ArenaDupStr(Arena *arena, const char *p)
+{
+    size_t len = strlen(p) + 1;
+
+    return memcpy(ArenaAlloc(arena, len), p, len);
+}
+
+
+void ArenaReset(Arena *arena)
+{
+    arena->current = arena->first;
+
+    if (arena->first)
+    {
+        arena->first->used = 0;
+    }
+}
+
+
+void ArenaFree(Arena *arena)
+{
+    if (arena)
+    {
+        Block *b = arena->first;
+
+        while(b)
+        {
+            Block *n = b->next;
+
+            free(b);
+            b = n;
+        }
+
+        free(arena);
+    }
+}
+
+
+Arena *ArenaLine(void)
+{
+    if (!line_arena)
+    {
+        line_arena = ArenaCreate();
+    }
+
+    return line_arena;
+}
+
+
+Arena *ArenaPass(void)
+{
+    if (!pass_arena)
+    {
+        pass_arena = ArenaCreate();
+    }
+
+    return pass_arena;
+}
+
+
+Arena *ArenaPermanent(void)
+{
+    if (!permanent_arena)
+    {
+        permanent_arena = ArenaCreate();
+    }
+
+    return permanent_arena;
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
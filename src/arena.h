@@ -0,0 +1,74 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Region allocators.  Memory is taken from large blocks and all released
+    at once, rather than each allocation being freed.
+
+*/
+
+#ifndef CASM_ARENA_H
+#define CASM_ARENA_H
+
+#include <stdlib.h>
+
+typedef struct arena Arena;
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Create a new arena.
+*/
+Arena   *ArenaCreate(void);
+
+
+/* Allocate memory from an arena.  The memory is suitably aligned for any
+   type, and lasts until the arena is reset or freed.
+*/
+void    *ArenaAlloc(Arena *arena, size_t len);
+
+
+/* Duplicate a string in an arena.
+*/
+char    *ArenaDupStr(Arena *arena, const char *p);
+
+
+/* Release everything allocated from an arena.  The blocks are kept for reuse.
+*/
+void    ArenaReset(Arena *arena);
+
+
+/* Free an arena and everything allocated from it.
+*/
+void    ArenaFree(Arena *arena);
+
+
+/* Shared arenas.  The line arena is reset after each line an assembly pass
+   runs, the pass arena after each pass, and the permanent arena never is.
+*/
+Arena   *ArenaLine(void);
+Arena   *ArenaPass(void);
+Arena   *ArenaPermanent(void);
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
@@ -0,0 +1,173 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Assembling many files at once, as started with --batch.
+
+    Each file is assembled in a child forked from this process once the
+    command line and tables have been set up, so the children skip the
+    program's startup and start from the same state.  As many children as
+    there are processors run at once.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CASM_POSIX
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "global.h"
+#include "source.h"
+#include "output.h"
+#include "batch.h"
+
+
+#ifdef CASM_POSIX
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+
+/* Wait for a child to finish, returning the index of its file and setting
+   ok.  Returns -1 if there are no children left.
+*/
+static int WaitChild(pid_t pid[], int count, int *ok)
+{
+    pid_t done;
+    int status;
+    int f;
+
+    while((done = wait(&status)) != -1)
+    {
+        for(f = 0; f < count; f++)
+        {
+            if (pid[f] == done)
+            {
+                pid[f] = 0;
+                *ok = WIFEXITED(status) &&
+                        WEXITSTATUS(status) == EXIT_SUCCESS;
+                return f;
+            }
+        }
+    }
+
+    return -1;
+}
+
+#endif
+
+
+/* ---------------------------------------- INTERFACES
+*/
+int Batch(int count, char *path[], int (*assemble)(void))
+{
+#ifdef CASM_POSIX
+    pid_t *pid;
+    long jobs;
+    int running = 0;
+    int failed = 0;
+    int ok;
+    int f;
+
+    if ((jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+    {
+        jobs = 1;
+    }
+
+    pid = Malloc((sizeof *pid) * (count ? count : 1));
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for(f = 0; f < count || running > 0; )
+    {
+        int done;
+
+        if (f < count && running < jobs)
+        {
+            if (strcmp(path[f], "-") == 0)
+            {
+                fprintf(stderr, "--batch can't read a source from stdin\n");
+                pid[f++] = 0;
+                failed++;
+                continue;
+            }
+
+            /* Files assembled at the same time mustn't share an output
+               file, so each gets a default named after it
+            */
+            if ((pid[f] = fork()) == 0)
+            {
+                OutputNameFrom(path[f]);
+
+                if (!SourceLoad(path[f]) || !SourceHasContents())
+                {
+                    exit(EXIT_FAILURE);
+                }
+
+                exit(assemble());
+            }
+
+            if (pid[f] == -1)
+            {
+                fprintf(stderr, "%s: failed to start\n", path[f]);
+                pid[f] = 0;
+                failed++;
+            }
+            else
+            {
+                running++;
+            }
+
+            f++;
+            continue;
+        }
+
+        if ((done = WaitChild(pid, f, &ok)) == -1)
+        {
+            break;
+        }
+
+        running--;
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: failed\n", path[done]);
+            failed++;
+        }
+    }
+
+    free(pid);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+#else
+    fprintf(stderr, "--batch is not supported on this system\n");
+    return EXIT_FAILURE;
+#endif
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
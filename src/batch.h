@@ -0,0 +1,46 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Assembling many files at once, as started with --batch.
+
+*/
+
+#ifndef CASM_BATCH_H
+#define CASM_BATCH_H
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Assemble each of the count files in path independently.  Each is loaded
+   and passed to assemble, which runs the passes and writes the output,
+   returning an exit status.  Files are assembled in copies of this process,
+   as many at once as there are processors, so assemble starts from the same
+   state for each.
+
+   Returns EXIT_SUCCESS if every file assembled, otherwise EXIT_FAILURE.
+*/
+int     Batch(int count, char *path[], int (*assemble)(void));
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
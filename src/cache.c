@@ -0,0 +1,200 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Persistent cache of data derived from file contents, kept between runs.
+
+    Each entry is a file in the cache directory named after its key.  The
+    key is a hash of the contents the data came from, so entries never go
+    stale; they are just no longer asked for.  Entries start with a header
+    line giving the size and a checksum of the data, so a damaged entry is
+    ignored rather than used.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CASM_POSIX
+#include <unistd.h>
+#endif
+
+#include "global.h"
+#include "cache.h"
+
+
+/* ---------------------------------------- GLOBALS
+*/
+static const char       *directory;
+
+
+#define HEADER_FORMAT   "casm-cache %lu %08lx\n"
+
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+static void Path(char *path, size_t size, const char *key)
+{
+    snprintf(path, size, "%s/%s", directory, key);
+}
+
+
+static unsigned long Checksum(const void *data, size_t size, unsigned long h)
+{
+    const unsigned char *p = data;
+    size_t f;
+
+    for(f = 0; f < size; f++)
+    {
+        h = ((h ^ p[f]) * 0x01000193UL) & 0xffffffffUL;
+    }
+
+    return h;
+}
+
+
+/* ---------------------------------------- INTERFACES
+*/
+void CacheSetDirectory(const char *dir)
+{
+    directory = dir;
+}
+
+
+int CacheEnabled(void)
+{
+    return directory != NULL;
+}
+
+
+void CacheKey(char *key, const char *kind, const void *data, size_t size)
+{
+    /* Two 32-bit FNV-1a hashes with different starting values, to give a
+       64-bit key from plain ISO C
+    */
+    unsigned long hi = Checksum(data, size, 0x811c9dc5UL);
+    unsigned long lo = Checksum(data, size, 0x050c5d1fUL);
+
+    snprintf(key, CACHE_KEY_SIZE, "%s-%08lx%08lx-%lx", kind, hi, lo,
+                                                        (unsigned long)size);
+}
+
+
+void *CacheRead(const char *key, size_t *size)
+{
+    char path[CASM_MAX_LINE_LENGTH];
+    char header[64];
+    char *data;
+    unsigned long len;
+    unsigned long sum;
+    FILE *fp;
+
+    if (!directory)
+    {
+        return NULL;
+    }
+
+    Path(path, sizeof path, key);
+
+    if (!(fp = fopen(path, "rb")))
+    {
+        return NULL;
+    }
+
+    if (!fgets(header, sizeof header, fp) ||
+            sscanf(header, HEADER_FORMAT, &len, &sum) != 2)
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    data = Malloc(len + 1);
+
+    if (fread(data, 1, len, fp) != len || fgetc(fp) != EOF ||
+            Checksum(data, len, 0x811c9dc5UL) != sum)
+    {
+        free(data);
+        data = NULL;
+    }
+    else
+    {
+        *size = len;
+    }
+
+    fclose(fp);
+
+    return data;
+}
+
+
+void CacheWrite(const char *key, const void *data, size_t size)
+{
+    char path[CASM_MAX_LINE_LENGTH];
+    char tmp[CASM_MAX_LINE_LENGTH + 64];
+    unsigned long id;
+    FILE *fp;
+    int ok;
+
+    if (!directory)
+    {
+        return;
+    }
+
+    /* Written under a temporary name and renamed, so another run never
+       sees a partly written entry.  The name has to be different for each
+       process, as --batch and --serve fork children that share a stack
+       layout, and for each thread, which the address of a local gives.
+    */
+#ifdef CASM_POSIX
+    id = (unsigned long)getpid();
+#else
+    id = (unsigned long)time(NULL);
+#endif
+
+    Path(path, sizeof path, key);
+
+    if (snprintf(tmp, sizeof tmp, "%s.%lx.%p.tmp",
+                        path, id, (void *)&ok) >= (int)sizeof tmp)
+    {
+        return;
+    }
+
+    if (!(fp = fopen(tmp, "wb")))
+    {
+        return;
+    }
+
+    ok = fprintf(fp, HEADER_FORMAT, (unsigned long)size,
+                        Checksum(data, size, 0x811c9dc5UL)) > 0 &&
+                fwrite(data, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+    }
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
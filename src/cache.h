@@ -0,0 +1,69 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Persistent cache of data derived from file contents, kept between runs.
+
+*/
+
+#ifndef CASM_CACHE_H
+#define CASM_CACHE_H
+
+#include <stdlib.h>
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Set the directory the cache is kept in.  If NULL, or never called, then
+   there is no cache and the other calls do nothing.
+*/
+void    CacheSetDirectory(const char *dir);
+
+
+/* Returns TRUE if there is a cache.
+*/
+int     CacheEnabled(void);
+
+
+/* Make a key for some contents.  The key is a string written to key, which
+   must be at least CACHE_KEY_SIZE long.  kind says what the cached data
+   is, so that different things derived from the same contents don't clash.
+*/
+#define CACHE_KEY_SIZE  64
+
+void    CacheKey(char *key, const char *kind, const void *data, size_t size);
+
+
+/* Read the data stored against a key.  Returns a buffer to release with
+   free(), or NULL if nothing is stored.
+*/
+void    *CacheRead(const char *key, size_t *size);
+
+
+/* Store data against a key.  Failures are silently ignored, as the cache
+   is only an optimisation.
+*/
+void    CacheWrite(const char *key, const void *data, size_t size);
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
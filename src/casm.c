@@ -27,13 +27,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
-#include <time.h>
 
 #include "global.h"
 #include "expr.h"
 #include "label.h"
 #include "macro.h"
 #include "parse.h"
+#include "arena.h"
 #include "cmd.h"
 #include "state.h"
 #include "codepage.h"
@@ -42,6 +42,11 @@
 #include "alias.h"
 #include "output.h"
 #include "source.h"
+#include "cache.h"
+#include "serve.h"
+#include "batch.h"
+#include "hash.h"
+#include "stats.h"
 
 /* ---------------------------------------- PROCESSORS
 */
@@ -67,7 +72,23 @@ static const char *casm_usage =
 "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the\n"
 "GNU General Public License (Version 3) for more details.\n"
 "\n"
-"usage: casm [-h|file]\n";
+"usage: casm [-h|[--stats|--stats-json] [--cache dir] [--serve] file]\n"
+"       casm [--stats|--stats-json] [--cache dir] --batch file...\n"
+"\n"
+"--stats prints the time taken and lines run by each pass to stderr, along\n"
+"with call counts and times for the busiest functions.  --stats-json prints\n"
+"the same as one JSON object when casm finishes.\n"
+"\n"
+"--cache keeps the tokenised form of each source file in dir, so later runs\n"
+"don't have to parse unchanged files again.\n"
+"\n"
+"--serve keeps running after assembling file, and assembles it again when\n"
+"any of its source files change or \"build\" is read from stdin.  Only\n"
+"changed files are read again.  \"build ok\" or \"build failed\" is written\n"
+"to stdout after each build, and \"quit\" or the end of stdin stops it.\n"
+"\n"
+"--batch assembles each file on its own, as if casm was run once for each,\n"
+"running as many at once as there are processors.\n";
 
 
 /* ---------------------------------------- TYPES
@@ -150,6 +171,18 @@ static const CPU *cpu = cpu_table;
 static ValTableHandler  *valtable_handler;
 static int              valtable_count;
 
+/* Lines run in the current pass, including macro lines
+*/
+static long             lines_run;
+
+/* Set when --stats or --stats-json is used
+*/
+static int              stats;
+
+/* Calls to each CPU's handler, indexed as cpu_table
+*/
+static StatsCounter     cpu_stats[sizeof cpu_table / sizeof cpu_table[0]];
+
 
 /* ---------------------------------------- OPTIONS
 */
@@ -209,6 +242,7 @@ static void             CheckLimits(void);
 static void             InitProcessors(void);        
 static void             RunPass(void);
 static void             ProduceOutput(void);
+static int              Assemble(void);
 
 
 
@@ -328,14 +362,30 @@ static CommandStatus DS(const char *label, int argc, char *argv[],
     CMD_ARGC_CHECK(2);
     CMD_EXPR(argv[1], count);
 
-    for(f = 0; f < count; f++)
+    if (count < 1)
+    {
+        return CMD_OK;
+    }
+
+    /* The fill value only needs evaluating per byte if it changes with the
+       PC.
+    */
+    if (argc > 2 && ExprUsesPC(argv[2]))
+    {
+        for(f = 0; f < count; f++)
+        {
+            CMD_EXPR(argv[2], value);
+            PCWrite(value);
+        }
+    }
+    else
     {
         if (argc > 2)
         {
             CMD_EXPR(argv[2], value);
         }
 
-        PCWrite(value);
+        PCFill(value, count);
     }
 
     return CMD_OK;
@@ -422,14 +472,28 @@ static CommandStatus ALIGN(const char *label, int argc, char *argv[],
 
     while ((PC() % count))
     {
-        if (argc > 2)
+        ulong n = count - PC() % count;
+
+        /* Stop at the end of the address space, as the PC wraps to zero
+        */
+        if (n > cpu->address_space - PC())
+        {
+            n = cpu->address_space - PC();
+        }
+
+        if (argc < 3)
+        {
+            PCAdd(n);
+        }
+        else if (ExprUsesPC(argv[2]))
         {
             CMD_EXPR(argv[2], value);
             PCWrite(value);
         }
         else
         {
-            PCAdd(1);
+            CMD_EXPR(argv[2], value);
+            PCFill(value, n);
         }
     }
 
@@ -441,8 +505,8 @@ static CommandStatus INCBIN(const char *label, int argc, char *argv[],
                             int quoted[], char *err, size_t errsize)
 {
     FILE *fp;
-    int num;
-    unsigned char buff[CASM_MAX_LINE_LENGTH];
+    size_t num;
+    static Byte buff[0x10000];
 
     CMD_ARGC_CHECK(2);
 
@@ -454,12 +518,7 @@ static CommandStatus INCBIN(const char *label, int argc, char *argv[],
 
     while((num = fread(buff, 1, sizeof buff, fp)) > 0)
     {
-        int f;
-
-        for(f = 0; f < num; f++)
-        {
-            PCWrite(buff[f]);
-        }
+        PCWriteBlock(buff, num);
     }
 
     fclose(fp);
@@ -595,7 +654,7 @@ static CommandStatus IMPORT(const char *label, int argc, char *argv[],
 
 
 
-static struct
+static struct command
 {
     const char *cmd;
     Command     handler;
@@ -647,26 +706,53 @@ static struct
     {".alias", ALIAS},
     {"nullcmd", NULLCMD},
     {".nullcmd", NULLCMD},
+    {"once", NULLCMD},
+    {".once", NULLCMD},
     {"import", IMPORT},
     {".import", IMPORT},
     {NULL}
 };
 
 
-static CommandStatus RunInternal(const char *label, int argc, char *argv[],
-                                 int quoted[], char *err, size_t errsize)
+/* The command table indexed by name, built the first time a command is run
+*/
+static HashTable *command_index;
+
+
+static Command FindInternal(const char *name)
 {
+    const struct command *c;
     int f;
 
-    for(f = 0; command_table[f].cmd; f++)
+    if (!command_index)
     {
-        if (CompareString(command_table[f].cmd, argv[0]))
+        command_index = HashCreate();
+
+        for(f = 0; command_table[f].cmd; f++)
         {
-            return command_table[f].handler(label, argc, argv,
-                                            quoted, err, errsize);
+            HashAdd(command_index, command_table[f].cmd, command_table + f);
         }
     }
 
+    if ((c = HashFind(command_index, name)))
+    {
+        return c->handler;
+    }
+
+    return NULL;
+}
+
+
+static CommandStatus RunInternal(const char *label, int argc, char *argv[],
+                                 int quoted[], char *err, size_t errsize)
+{
+    Command handler = FindInternal(argv[0]);
+
+    if (handler)
+    {
+        return handler(label, argc, argv, quoted, err, errsize);
+    }
+
     return CMD_NOT_KNOWN;
 }
 
@@ -675,8 +761,12 @@ static CommandStatus RunInternal(const char *label, int argc, char *argv[],
 */
 int main(int argc, char *argv[])
 {
-    FILE *fp = NULL;
-    int done = FALSE;
+    int serve = FALSE;
+    char **batch = NULL;
+    int batch_count = 0;
+    double start = 0;
+    const char *file;
+    int status;
     int f;
 
     CheckLimits();
@@ -687,6 +777,57 @@ int main(int argc, char *argv[])
         return EXIT_SUCCESS;
     }
 
+    f = 1;
+
+    if (argv[f] && (strcmp(argv[f], "--stats") == 0 ||
+                    strcmp(argv[f], "--stats-json") == 0))
+    {
+        stats = TRUE;
+        StatsEnable(strcmp(argv[f], "--stats-json") == 0);
+        f++;
+    }
+
+    if (argv[f] && strcmp(argv[f], "--cache") == 0)
+    {
+        if (!argv[f + 1])
+        {
+            fprintf(stderr,"%s\n", casm_usage);
+            return EXIT_FAILURE;
+        }
+
+        CacheSetDirectory(argv[f + 1]);
+        f += 2;
+    }
+
+    if (argv[f] && strcmp(argv[f], "--serve") == 0)
+    {
+        serve = TRUE;
+        f++;
+    }
+    else if (argv[f] && strcmp(argv[f], "--batch") == 0)
+    {
+        if (!argv[f + 1])
+        {
+            fprintf(stderr,"%s\n", casm_usage);
+            return EXIT_FAILURE;
+        }
+
+        batch = argv + f + 1;
+        batch_count = argc - f - 1;
+        f++;
+    }
+
+    file = argv[f];
+
+    if (stats)
+    {
+        for(f = 0; cpu_table[f].name; f++)
+        {
+            snprintf(cpu_stats[f].name, sizeof cpu_stats[f].name,
+                                    "Handler %s", cpu_table[f].name);
+        }
+    }
+
     PushValTableHandler(option_set, SetOption);
     PushValTableHandler(ListOptions(), ListSetOption);
     PushValTableHandler(MacroOptions(), MacroSetOption);
@@ -709,7 +850,22 @@ int main(int argc, char *argv[])
     SetPC(0);
     InitProcessors();
 
-    if (!SourceLoad(argv[1]))
+    if (stats)
+    {
+        start = StatsTime();
+    }
+
+    if (serve)
+    {
+        return Serve(file, Assemble);
+    }
+
+    if (batch)
+    {
+        return Batch(batch_count, batch, Assemble);
+    }
+
+    if (!SourceLoad(file))
     {
         return EXIT_FAILURE;
     }
@@ -719,15 +875,56 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (stats)
+    {
+        StatsValue("load", StatsTime() - start);
+    }
+
+    status = Assemble();
+
+    SourceFree();
+
+    return status;
+}
+
+
+/* ---------------------------------------- ASSEMBLY
+*/
+
+/* Run the passes over the loaded source and write the output
+*/
+static int Assemble(void)
+{
+    int done = FALSE;
+    double start = 0;
+
     while(!done)
     {
+        if (stats)
+        {
+            start = StatsTime();
+            lines_run = 0;
+        }
+
         RunPass();
         SourceRewind();
+        LabelEndPass();
+        ArenaReset(ArenaPass());
+
+        if (stats)
+        {
+            char name[32];
+
+            snprintf(name, sizeof name, "pass %d", GetCurrentPass());
+            StatsValue(name, StatsTime() - start);
+            snprintf(name, sizeof name, "lines %d", GetCurrentPass());
+            StatsNumber(name, lines_run);
+        }
 
         SetAddressBank(0);
         SetPC(0);
         MacroSetDefaults();
-        AliasClear();
+        AliasRewind();
         InitProcessors();
         LabelResetNamespace();
 
@@ -735,15 +932,38 @@ int main(int argc, char *argv[])
         {
             done = TRUE;
         }
-        else
+        else if (!NextPass())
         {
-            NextPass();
+            const char *label = PassUnstableLabel();
+
+            if (label)
+            {
+                fprintf(stderr, "Label values didn't settle after %d passes; "
+                                "'%s' was still changing\n", MaxPasses() - 1,
+                                label);
+            }
+            else
+            {
+                fprintf(stderr, "Label values didn't settle after %d passes\n",
+                                MaxPasses() - 1);
+            }
+
+            return EXIT_FAILURE;
         }
     }
 
+    if (stats)
+    {
+        start = StatsTime();
+    }
+
     ProduceOutput();
 
-    SourceFree();
+    if (stats)
+    {
+        StatsValue("output", StatsTime() - start);
+        StatsReport();
+    }
 
     return EXIT_SUCCESS;
 }
@@ -793,6 +1013,273 @@ static void InitProcessors(void)
 
 /* ---------------------------------------- ASSEMBLY PASS
 */
+
+/* What the command on a line was found to be.  Source lines keep this so
+   later passes don't have to look it up again, which is only valid while the
+   CPU and aliases are the same as when it was found.
+*/
+typedef enum
+{
+    CMD_TYPE_END,
+    CMD_TYPE_INCLUDE,
+    CMD_TYPE_MACRO_DEF,
+    CMD_TYPE_ENDM,
+    CMD_TYPE_REPEAT,
+    CMD_TYPE_ENDR,
+    CMD_TYPE_OTHER
+} CommandType;
+
+typedef enum
+{
+    RUN_UNKNOWN,        /* Try the CPU, and then macros */
+    RUN_INTERNAL,
+    RUN_CPU,
+    RUN_MACRO
+} RunType;
+
+/* The size a CPU command added to the PC, and the labels that size came
+   from.
+*/
+typedef struct
+{
+    int         valid;
+    ulong       pc;
+    unsigned    bank;
+    ulong       size;
+    LabelDeps   deps;
+} Memo;
+
+typedef struct
+{
+    const CPU   *cpu;
+    unsigned    alias_generation;
+    char        *command;
+    CommandType type;
+    RunType     run;
+    Command     internal;
+    MacroDef    *macro;
+    Memo        memo;
+} Resolved;
+
+
+static void Resolve(Resolved *r, char *command)
+{
+    r->cpu = cpu;
+    r->alias_generation = AliasGeneration();
+    r->command = AliasExpand(command);
+    r->internal = FindInternal(r->command);
+    r->run = r->internal ? RUN_INTERNAL : RUN_UNKNOWN;
+    r->macro = NULL;
+
+    if (CompareString(r->command, "end") ||
+            CompareString(r->command, ".end"))
+    {
+        r->type = CMD_TYPE_END;
+    }
+    else if (CompareString(r->command, "include") ||
+                CompareString(r->command, ".include"))
+    {
+        r->type = CMD_TYPE_INCLUDE;
+    }
+    else if (CompareString(r->command, "macro"))
+    {
+        r->type = CMD_TYPE_MACRO_DEF;
+    }
+    else if (CompareString(r->command, "endm"))
+    {
+        r->type = CMD_TYPE_ENDM;
+    }
+    else if (CompareString(r->command, "rept") ||
+                CompareString(r->command, ".rept") ||
+                CompareString(r->command, "irp") ||
+                CompareString(r->command, ".irp"))
+    {
+        r->type = CMD_TYPE_REPEAT;
+    }
+    else if (CompareString(r->command, "endr") ||
+                CompareString(r->command, ".endr"))
+    {
+        r->type = CMD_TYPE_ENDR;
+    }
+    else
+    {
+        r->type = CMD_TYPE_OTHER;
+    }
+}
+
+
+static Resolved *CachedResolved(void **cache, char *command)
+{
+    Resolved *r = *cache;
+
+    if (!r)
+    {
+        r = Malloc(sizeof *r);
+        r->cpu = NULL;
+        r->memo.valid = FALSE;
+        r->memo.deps.dep = NULL;
+        r->memo.deps.size = 0;
+        *cache = r;
+    }
+
+    if (r->cpu != cpu || r->alias_generation != AliasGeneration())
+    {
+        Resolve(r, command);
+        r->memo.valid = FALSE;
+    }
+
+    return r;
+}
+
+
+/* On an intermediate pass a CPU command only matters for how far it moves the
+   PC.  If none of the labels it read last time have changed since, the size
+   it produced then is still right and the command needn't be run.
+*/
+static int MemoReuse(const Memo *m)
+{
+    if (!m->valid)
+    {
+        return FALSE;
+    }
+
+    if (m->deps.uses_pc && (m->pc != PC() || m->bank != CurrentBank()))
+    {
+        return FALSE;
+    }
+
+    if (!LabelDepsUnchanged(&m->deps))
+    {
+        return FALSE;
+    }
+
+    PCAdd(m->size);
+
+    return TRUE;
+}
+
+
+static void MemoStart(Memo *m)
+{
+    m->pc = PC();
+    m->bank = CurrentBank();
+    LabelRecordStart(&m->deps);
+}
+
+
+/* Commands that didn't move the PC forward may instead have changed CPU state,
+   so only commands that output something are remembered.
+*/
+static void MemoEnd(Memo *m, CommandStatus cmdstat)
+{
+    int complete = LabelRecordStop();
+
+    m->valid = complete && cmdstat == CMD_OK &&
+                    m->bank == CurrentBank() && PC() > m->pc;
+
+    m->size = PC() - m->pc;
+}
+
+/* A conditional block being run.  taken is set once one of its branches has
+   been run, and level is how deeply nested in macros it was started.
+*/
+typedef struct
+{
+    int         taken;
+    int         else_seen;
+    int         level;
+} Conditional;
+
+
+/* The outcome of each conditional test in the order they were run, for the
+   last pass and this one.  Once a pass goes a different way to the last one
+   the CPU state may not be what memos were recorded with, and labels after it
+   may well move, so memos aren't reused and another pass is needed.
+*/
+static char     *outcome[2];
+static int      outcome_size[2];
+static int      no_outcomes[2];
+static int      outcomes_changed;
+
+
+static void StartOutcomes(void)
+{
+    char *p = outcome[0];
+    int size = outcome_size[0];
+
+    outcome[0] = outcome[1];
+    outcome_size[0] = outcome_size[1];
+    no_outcomes[0] = no_outcomes[1];
+
+    outcome[1] = p;
+    outcome_size[1] = size;
+    no_outcomes[1] = 0;
+
+    outcomes_changed = FALSE;
+}
+
+
+static void RecordOutcome(int result)
+{
+    int n = no_outcomes[1];
+
+    if (!outcomes_changed && !IsFirstPass() &&
+                    (n >= no_outcomes[0] || outcome[0][n] != result))
+    {
+        outcomes_changed = TRUE;
+        PassUnstable(NULL);
+    }
+
+    if (n == outcome_size[1])
+    {
+        outcome_size[1] = outcome_size[1] ? outcome_size[1] * 2 : 256;
+        outcome[1] = Realloc(outcome[1], outcome_size[1]);
+    }
+
+    outcome[1][no_outcomes[1]++] = result;
+}
+
+
+/* Work out whether an if, ifdef, ifndef or elseif is true.  ifdef only counts
+   labels already set this pass, so that each pass goes the same way.
+*/
+static CommandStatus TestCondition(ConditionalType type,
+                                   int argc, char *argv[], int *result,
+                                   char *err, size_t errsize)
+{
+    if (argc < 2)
+    {
+        snprintf(err, errsize, "%s: missing argument", argv[0]);
+        return CMD_FAILED;
+    }
+
+    if (type == COND_IFDEF || type == COND_IFNDEF)
+    {
+        const Label *l = LabelFind(argv[1], ANY_LABEL);
+        int set = l && l->set_pass == GetCurrentPass();
+
+        *result = type == COND_IFDEF ? set : !set;
+    }
+    else
+    {
+        long value;
+
+        if (!ExprEval(argv[1], &value))
+        {
+            snprintf(err, errsize, "%s: expression error:  %s",
+                                                argv[0], ExprError());
+            return CMD_FAILED;
+        }
+
+        *result = value != 0;
+    }
+
+    RecordOutcome(*result);
+
+    return CMD_OK;
+}
+
+
 static CommandStatus RunLine(const char *label, int argc, char *argv[],
                              int quoted[], char *err, size_t errsize)
 {
@@ -813,52 +1300,111 @@ static CommandStatus RunLine(const char *label, int argc, char *argv[],
 
 static void RunPass(void)
 {
-    char src[CASM_MAX_LINE_LENGTH];
+    char label_buff[CASM_MAX_LINE_LENGTH];
     char err[CASM_MAX_LINE_LENGTH];
     MacroDef *macro_def = NULL;
     Stack *macro_stack;
     Macro *macro = NULL;
     int skip_macro = FALSE;
+    MacroDef *repeat_def = NULL;
+    Macro *repeat = NULL;
+    int repeat_record = FALSE;
+    int repeat_depth = 0;
+    Conditional *cond = NULL;
+    int no_cond = 0;
+    int cond_size = 0;
+    int skipping = FALSE;
+    int skip_depth = 0;
+    char **args = NULL;
+    int *arg_quotes = NULL;
+    int args_size = 0;
+    Resolved macro_cmd;
+    double start = 0;
 
     macro_stack = StackCreate();
+    StartOutcomes();
 
     while(TRUE)
     {
-        Line line;
+        Line parsed = {0};
+        const Line *line = NULL;
+        const char *src = "";
+        int from_source = FALSE;
+        void **command_cache = NULL;
         char *label = NULL;
         LabelType type;
         int cmd_offset = 0;
         CommandStatus cmdstat;
+        Resolved *cmd;
+        ConditionalType cond_type;
         char **argv;
         int argc;
         int *quoted;
+        int f;
+
+        lines_run++;
 
         ListStartLine();
 
         if (macro)
         {
-            char *next;
+            const char *next;
 
             next = MacroPlay(macro);
 
-            if (next)
-            {
-                CopyStr(src, next, sizeof src);
-                free(next);
-            }
-            else
+            if (!next)
             {
-                ListMacroInvokeEnd(MacroName(macro));
+                int scoped = MacroScoped(macro);
+
+                if (no_cond && cond[no_cond - 1].level ==
+                                                StackSize(macro_stack) + 1)
+                {
+                    snprintf(err, sizeof err,"Unterminated if");
+                    cmdstat = CMD_FAILED;
+                    goto error_handling;
+                }
+
+                /* Each time round a repeated block with labels gets a new
+                   scope for them
+                */
+                if (MacroNextIteration(macro))
+                {
+                    if (scoped)
+                    {
+                        LabelScopePop();
+                        LabelScopePush(LabelCreateNamespace(), PC());
+                    }
+
+                    goto next_line;
+                }
+
+                if (!MacroIsRepeat(macro))
+                {
+                    ListMacroInvokeEnd(MacroName(macro));
+                }
+
                 MacroFree(macro);
                 macro = StackPop(macro_stack);
-                LabelScopePop();
+
+                if (scoped)
+                {
+                    LabelScopePop();
+                }
+
                 goto next_line;
             }
+
+            /* Recorded lines never hold a newline, and the played line lasts
+               until the line arena is reset
+            */
+            src = next;
         }
         
         if (!macro)
         {
-            if (!SourceRead(src, sizeof src))
+            /* Source lines were tokenised when loaded
+            */
+            if (!SourceRead(&src, &line))
             {
                 if (macro_def)
                 {
@@ -867,25 +1413,174 @@ static void RunPass(void)
                     goto error_handling;
                 }
 
+                if (repeat)
+                {
+                    snprintf(err, sizeof err,"Unterminated %s",
+                                                        MacroName(repeat));
+                    cmdstat = CMD_FAILED;
+                    goto error_handling;
+                }
+
+                if (no_cond)
+                {
+                    snprintf(err, sizeof err,"Unterminated if");
+                    cmdstat = CMD_FAILED;
+                    goto error_handling;
+                }
+
                 StackFree(macro_stack);
+                free(cond);
+                free(arg_quotes);
+                free(args);
                 return;
             }
+
+            from_source = TRUE;
+
+            /* Expressions in source lines don't change, so can be compiled
+               once and kept with the line
+            */
+            ExprSetCache(SourceExprCache());
+            command_cache = SourceCommandCache();
         }
+        else if ((line = MacroParsedLine(macro)))
+        {
+            /* Lines of repeated blocks that don't change were tokenised when
+               recorded, and may keep their expressions like source lines
+            */
+            ExprSetCache(MacroExprCache(macro));
+            command_cache = MacroCommandCache(macro);
+        }
+        else
+        {
+            /* Macro lines have to be parsed as argument expansion means
+               they change
+            */
+            if (!ParseLine(&parsed, src, ArenaLine()))
+            {
+                snprintf(err, sizeof err,"%s\n%s", src, ParseError());
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
 
-        RemoveNL(src);
+            line = &parsed;
+        }
 
-        if (!ParseLine(&line, src))
+        /* Lines of a block to be repeated are recorded, or skipped if the
+           block was recorded on an earlier pass, up to the endr that matches
+           it.  Their labels are left to be set as the block is played.
+        */
+        if (repeat)
         {
-            snprintf(err, sizeof err,"%s\n%s", src, ParseError());
-            cmdstat = CMD_FAILED;
-            goto error_handling;
+            int offset = line->first_column ? 1 : 0;
+            CommandType ctype = CMD_TYPE_OTHER;
+
+            if (line->no_tokens > offset)
+            {
+                Resolve(&macro_cmd, line->token[offset]);
+                ctype = macro_cmd.type;
+            }
+
+            if (ctype == CMD_TYPE_ENDR && repeat_depth == 0)
+            {
+                if (repeat_record)
+                {
+                    MacroRecordEnd(repeat_def);
+                }
+
+                if (MacroNextIteration(repeat))
+                {
+                    if (macro)
+                    {
+                        StackPush(macro_stack, macro);
+
+                        if (StackSize(macro_stack) > 1023)
+                        {
+                            snprintf(err, sizeof err,
+                                            "Macro invocation too deep");
+                            cmdstat = CMD_FAILED;
+                            goto error_handling;
+                        }
+                    }
+
+                    macro = repeat;
+
+                    STATS_PEAK("macro depth", StackSize(macro_stack) + 1);
+
+                    if (MacroScoped(macro))
+                    {
+                        LabelScopePush(LabelCreateNamespace(), PC());
+                    }
+                }
+
+                repeat = NULL;
+                repeat_def = NULL;
+                goto next_line;
+            }
+
+            /* An include in the block is run as it's recorded, so a file
+               only included once is only recorded once
+            */
+            if (ctype == CMD_TYPE_INCLUDE && from_source &&
+                                        !SourceInclude(err, sizeof err))
+            {
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
+
+            if (ctype == CMD_TYPE_REPEAT)
+            {
+                repeat_depth++;
+            }
+            else if (ctype == CMD_TYPE_ENDR)
+            {
+                repeat_depth--;
+            }
+
+            if (repeat_record)
+            {
+                MacroRecord(repeat_def, src);
+            }
+
+            goto next_line;
         }
 
-        /* Check for labels
+        /* Lines in a conditional block that isn't being run are passed over,
+           apart from the conditionals that could end it.  Source lines are
+           jumped over without being looked at, so the line here is the one
+           ending the block.
         */
-        if (line.first_column)
+        cond_type = SourceConditional(line);
+
+        if (skipping)
         {
-            label = line.token[0];
+            if (cond_type == COND_IF || cond_type == COND_IFDEF ||
+                                        cond_type == COND_IFNDEF)
+            {
+                skip_depth++;
+                goto next_line;
+            }
+
+            if (cond_type == COND_NONE ||
+                            (skip_depth > 0 && cond_type != COND_ENDIF))
+            {
+                goto next_line;
+            }
+
+            if (skip_depth > 0)
+            {
+                skip_depth--;
+                goto next_line;
+            }
+
+            skipping = FALSE;
+        }
+
+        /* Check for labels.  The label is copied as it gets altered.
+        */
+        if (line->first_column)
+        {
+            label = CopyStr(label_buff, line->token[0], sizeof label_buff);
             cmd_offset = 1;
 
             if (!LabelSanatise(label, &type))
@@ -941,7 +1636,7 @@ static void RunPass(void)
 
         /* Check for no command/label only.  Still record for macro though.
         */
-        if (line.no_tokens == cmd_offset)
+        if (line->no_tokens == cmd_offset)
         {
             if (macro_def)
             {
@@ -953,35 +1648,84 @@ static void RunPass(void)
             goto next_line;
         }
 
-        argv = line.token + cmd_offset;
-        argc = line.no_tokens - cmd_offset;
-        quoted = line.quoted + cmd_offset;
+        /* Take a copy of the token pointers so the command can be replaced by
+           an alias without altering the stored line
+        */
+        argc = line->no_tokens - cmd_offset;
+        quoted = line->quoted + cmd_offset;
+
+        if (argc > args_size)
+        {
+            args_size = argc;
+            args = Realloc(args, (sizeof *args) * args_size);
+            arg_quotes = Realloc(arg_quotes, (sizeof *arg_quotes) * args_size);
+        }
+
+        argv = args;
+        memcpy(argv, line->token + cmd_offset, (sizeof *argv) * argc);
 
-        /* Expand aliases
+        /* Single quoted characters are converted with the codepage in use
+           now, which may not be the one there was when the line was parsed
         */
-        argv[0] = AliasExpand(argv[0]);
+        for(f = 0; f < argc; f++)
+        {
+            if (quoted[f] == QUOTED_CHAR)
+            {
+                if (quoted != arg_quotes)
+                {
+                    memcpy(arg_quotes, quoted, (sizeof *arg_quotes) * argc);
+                    quoted = arg_quotes;
+                }
+
+                argv[f] = ParseCharCode(argv[f], ArenaLine());
+                quoted[f] = 0;
+            }
+        }
+
+        /* Expand aliases and find what the command is.  Source lines
+           remember this from the last pass.
+        */
+        if (command_cache)
+        {
+            cmd = CachedResolved(command_cache, argv[0]);
+        }
+        else
+        {
+            cmd = &macro_cmd;
+            Resolve(cmd, argv[0]);
+        }
+
+        argv[0] = cmd->command;
 
         /* Check for END
         */
-        if (CompareString(argv[0], "end") || CompareString(argv[0], ".end"))
+        if (cmd->type == CMD_TYPE_END)
         {
             ListLine(src);
+            ExprSetCache(NULL);
+            free(cond);
+            free(arg_quotes);
+            free(args);
             return;
         }
 
-        /* Check for include
+        /* Check for include.  The included lines were spliced in after it
+           when loaded, but whether they're run is only decided here.
         */
-        if (CompareString(argv[0], "include") ||
-                CompareString(argv[0], ".include"))
+        if (cmd->type == CMD_TYPE_INCLUDE)
         {
-            /* Already handled by source loading
-            */
+            if (from_source && !SourceInclude(err, sizeof err))
+            {
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
+
             goto next_line;
         }
 
         /* Check for macro definition
         */
-        if (CompareString(argv[0], "macro"))
+        if (cmd->type == CMD_TYPE_MACRO_DEF)
         {
             /* Only define macros on the first pass
             */
@@ -1020,7 +1764,7 @@ static void RunPass(void)
             goto next_line;
         }
 
-        if (CompareString(argv[0], "endm"))
+        if (cmd->type == CMD_TYPE_ENDM)
         {
             if (!macro_def && IsFirstPass())
             {
@@ -1029,6 +1773,7 @@ static void RunPass(void)
                 goto error_handling;
             }
 
+            MacroRecordEnd(macro_def);
             macro_def = NULL;
             skip_macro = FALSE;
             goto next_line;
@@ -1045,13 +1790,193 @@ static void RunPass(void)
             goto next_line;
         }
 
+        /* Conditional assembly.  When a block isn't to be run the lines up to
+           the one that could end it are skipped.
+        */
+        if (cond_type != COND_NONE)
+        {
+            int level = StackSize(macro_stack) + (macro ? 1 : 0);
+            int run = FALSE;
+
+            ListLine(src);
+            cmdstat = CMD_OK;
+
+            if (cond_type != COND_IF && cond_type != COND_IFDEF &&
+                                        cond_type != COND_IFNDEF &&
+                    (!no_cond || cond[no_cond - 1].level != level))
+            {
+                snprintf(err, sizeof err, "%s: No if started", argv[0]);
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
+
+            switch(cond_type)
+            {
+                case COND_ELSEIF:
+                case COND_ELSE:
+                    if (cond[no_cond - 1].else_seen)
+                    {
+                        snprintf(err, sizeof err, "%s: else already seen",
+                                                                argv[0]);
+                        cmdstat = CMD_FAILED;
+                        goto error_handling;
+                    }
+
+                    if (cond_type == COND_ELSE)
+                    {
+                        cond[no_cond - 1].else_seen = TRUE;
+                        run = !cond[no_cond - 1].taken;
+                    }
+                    else if (!cond[no_cond - 1].taken)
+                    {
+                        cmdstat = TestCondition(cond_type, argc, argv, &run,
+                                                err, sizeof err);
+                    }
+
+                    cond[no_cond - 1].taken |= run;
+                    break;
+
+                case COND_ENDIF:
+                    no_cond--;
+                    run = TRUE;
+                    break;
+
+                default:
+                    cmdstat = TestCondition(cond_type, argc, argv, &run,
+                                            err, sizeof err);
+
+                    if (no_cond == cond_size)
+                    {
+                        cond_size = cond_size ? cond_size * 2 : 16;
+                        cond = Realloc(cond, (sizeof *cond) * cond_size);
+                    }
+
+                    cond[no_cond].taken = run;
+                    cond[no_cond].else_seen = FALSE;
+                    cond[no_cond].level = level;
+                    no_cond++;
+                    break;
+            }
+
+            if (cmdstat != CMD_OK)
+            {
+                goto error_handling;
+            }
+
+            if (!run)
+            {
+                skipping = TRUE;
+                skip_depth = 0;
+
+                if (from_source)
+                {
+                    SourceSkipBlock();
+                }
+            }
+
+            goto next_line;
+        }
+
+        /* Start recording a block to repeat.  Blocks in the source are only
+           recorded once, and kept with the line that starts them.
+        */
+        if (cmd->type == CMD_TYPE_REPEAT)
+        {
+            int irp = CompareString(cmd->command, "irp") ||
+                        CompareString(cmd->command, ".irp");
+            long count = 0;
+
+            if (argc < 2)
+            {
+                snprintf(err, sizeof err, "%s: missing argument", argv[0]);
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
+
+            if (!irp && !ExprEval(argv[1], &count))
+            {
+                snprintf(err, sizeof err, "%s: expression error:  %s",
+                                                    argv[0], ExprError());
+                cmdstat = CMD_FAILED;
+                goto error_handling;
+            }
+
+            repeat_def = from_source ? cmd->macro : NULL;
+            repeat_record = !repeat_def;
+
+            if (!repeat_def)
+            {
+                repeat_def = MacroCreateRepeat(irp ? argv[1] : NULL,
+                                               from_source, err, sizeof err);
+
+                if (!repeat_def)
+                {
+                    cmdstat = CMD_FAILED;
+                    goto error_handling;
+                }
+
+                if (from_source)
+                {
+                    cmd->macro = repeat_def;
+                }
+            }
+
+            repeat = MacroRepeat(repeat_def, count, irp ? argc - 2 : 0,
+                                 argv + 2, quoted + 2);
+            repeat_depth = 0;
+
+            goto next_line;
+        }
+
+        if (cmd->type == CMD_TYPE_ENDR)
+        {
+            snprintf(err, sizeof err, "%s: No rept or irp started", argv[0]);
+            cmdstat = CMD_FAILED;
+            goto error_handling;
+        }
+
         /* Run internal then CPU commands.  Then if that fails try a macro.
         */
-        cmdstat = RunInternal(label, argc, argv, quoted, err, sizeof err);
+        cmdstat = CMD_NOT_KNOWN;
 
-        if (cmdstat == CMD_NOT_KNOWN)
+        if (cmd->run == RUN_INTERNAL)
         {
-            cmdstat = cpu->handler(label, argc, argv, quoted, err, sizeof err);
+            cmdstat = cmd->internal(label, argc, argv, quoted,
+                                    err, sizeof err);
+        }
+
+        if (cmdstat == CMD_NOT_KNOWN && cmd->run != RUN_MACRO)
+        {
+            if (from_source && IsIntermediatePass() && !outcomes_changed &&
+                            cmd->run == RUN_CPU && MemoReuse(&cmd->memo))
+            {
+                goto next_line;
+            }
+
+            STATS_START(start);
+
+            if (from_source && !IsFinalPass())
+            {
+                MemoStart(&cmd->memo);
+                cmdstat = cpu->handler(label, argc, argv, quoted,
+                                       err, sizeof err);
+                MemoEnd(&cmd->memo, cmdstat);
+            }
+            else
+            {
+                cmdstat = cpu->handler(label, argc, argv, quoted,
+                                       err, sizeof err);
+            }
+
+            STATS_END(cpu_stats[cpu - cpu_table], start);
+
+            /* The CPU only doesn't know a command because of its name, so
+               whether it did can be remembered
+            */
+            if (cmd->run == RUN_UNKNOWN)
+            {
+                cmd->run = cmdstat == CMD_NOT_KNOWN ? RUN_MACRO : RUN_CPU;
+            }
         }
 
         ListLine(src);
@@ -1060,7 +1985,13 @@ static void RunPass(void)
         {
             Macro *m;
 
-            cmdstat = MacroFind(&m, argc, argv, quoted, err, sizeof err);
+            if (!cmd->macro)
+            {
+                cmd->macro = MacroLookup(argv[0]);
+            }
+
+            cmdstat = MacroInvoke(&m, cmd->macro, argc, argv, quoted,
+                                  err, sizeof err);
 
             /* If we get a macro then create a new top-level label for it
             */
@@ -1080,6 +2011,8 @@ static void RunPass(void)
 
                 macro = m;
 
+                STATS_PEAK("macro depth", StackSize(macro_stack) + 1);
+
                 ListMacroInvokeStart(argc, argv, quoted);
 
                 LabelScopePush(LabelCreateNamespace(), PC());
@@ -1113,7 +2046,7 @@ error_handling:
                 ListError("%s(%d): Unknown command/opcode '%s'",
                                         SourceGetPath(), 
                                         SourceGetLineNumber(),
-                                        line.token[cmd_offset]);
+                                        argv[0]);
 
                 if (macro)
                 {
@@ -1147,9 +2080,17 @@ error_handling:
         }
 
 next_line:
-        ParseFree(&line);
+        ParseFree(&parsed);
+        ExprSetCache(NULL);
+        ArenaReset(ArenaLine());
 
-        SourceNext();
+        /* Only move on in the source once a line from it has been run, not
+           for each line a macro plays back
+        */
+        if (from_source)
+        {
+            SourceNext();
+        }
     }
 }
 
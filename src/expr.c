@@ -32,11 +32,13 @@
 #include "label.h"
 #include "state.h"
 #include "util.h"
+#include "arena.h"
+#include "stats.h"
 
 /* ---------------------------------------- MACROS
 */
 #define TYPE_OPERAND    0
-#define TYPE_LABEL      1
+#define TYPE_CONSTANT   1
 #define TYPE_OPERATOR   2       /* This acts as a base for operator tokens */
 #define TYPE_LPAREN     3
 #define TYPE_RPAREN     4
@@ -122,10 +124,36 @@ typedef struct
 typedef enum {OpOk, OpSyntaxError, OpUnknown} OpError;
 
 
+/* A step of a compiled expression.  Operands are either a TYPE_CONSTANT with
+   the value resolved, or a TYPE_OPERAND that is passed to LabelExpand() when
+   evaluated.
+*/
+typedef struct
+    {
+    int         token;
+    int         is_unary;
+    long        value;
+    char        *text;
+    } ExprOp;
+
+
+struct compiled_expr
+    {
+    char                *text;
+    int                 no_ops;
+    int                 first;
+    ExprOp              *op;
+    long                *stack;
+    struct compiled_expr *next;
+    };
+
+
 /* ---------------------------------------- GLOBALS
 */
 static char             error[1024];
 
+static CompiledExpr     **cache;
+
 static const Operator   op_info[]=
     {
         /* Unary ops - must be first in list.  Note that LPAREN is treated
@@ -165,20 +193,11 @@ static const Operator   op_info[]=
 /* ---------------------------------------- PRIVATE FUNCTIONS
 */
 
-/* Empty a stack
+/* Empty a stack.  The entries come from the line arena, so are just dropped.
 */
 static Stack *ClearStack(Stack *stack)
 {
-    while(stack)
-    {
-        Stack *tmp=stack;
-
-        stack=stack->next;
-        free(tmp->text);
-        free(tmp);
-    }
-
-    return stack;
+    return NULL;
 }
 
 
@@ -187,9 +206,9 @@ static Stack *ClearStack(Stack *stack)
 static Stack *Push(Stack *stack, int token, int priority, 
                    int is_unary, const char *text)
 {
-    Stack *e=Malloc(sizeof *e);
+    Stack *e=ArenaAlloc(ArenaLine(),sizeof *e);
 
-    e->text=DupStr(text);
+    e->text=ArenaDupStr(ArenaLine(),text);
     e->priority=priority;
     e->token=token;
     e->is_unary=is_unary;
@@ -200,18 +219,13 @@ static Stack *Push(Stack *stack, int token, int priority,
 }
 
 
-/* Destroy the top element on the stack
+/* Drop the top element on the stack
 */
 static Stack *Pop(Stack *stack)
 {
     if (stack)
     {
-        Stack *tmp=stack;
-
         stack=stack->next;
-
-        free(tmp->text);
-        free(tmp);
     }
 
     return stack;
@@ -444,146 +458,178 @@ static Stack *ToPostfix(const char *expr)
 }
 
 
-static int EvalPostfix(Stack **stack, long *result)
+/* Turn an expression into a flat postfix array, allocated from the passed
+   arena.  Returns NULL on error.
+*/
+static CompiledExpr *Compile(const char *expr, Arena *arena)
 {
-    Stack *expr;
-    int token;
+    CompiledExpr *e;
+    Stack *output;
+    Stack *s;
+    int need;
+    int f;
+
+    if (!(output=ToPostfix(expr)))
+        return NULL;
+
+    e=ArenaAlloc(arena,sizeof *e);
+
+    e->text=ArenaDupStr(arena,expr);
+    e->next=NULL;
+    e->no_ops=0;
 
-    expr=*stack;
+    for(s=output;s;s=s->next)
+        e->no_ops++;
 
-    if (!expr)
+    e->op=ArenaAlloc(arena,(sizeof *e->op) * e->no_ops);
+    e->stack=ArenaAlloc(arena,(sizeof *e->stack) * e->no_ops);
+
+    /* The top of the output stack is the last step
+    */
+    for(f=e->no_ops-1,s=output;s;f--,s=s->next)
     {
-        sprintf(error,"Called with empty postfix stack");
-        return FALSE;
+        ExprOp *op=e->op+f;
+
+        op->token=s->token;
+        op->is_unary=s->is_unary;
+        op->value=0;
+        op->text=ArenaDupStr(arena,s->text);
+
+        if (op->token==TYPE_OPERAND && LabelConstant(op->text,&op->value))
+        {
+            op->token=TYPE_CONSTANT;
+        }
     }
 
-    token=expr->token;
+    /* Find where the sub-expression of the final step starts.  Anything
+       before that is left over and ignored.
+    */
+    e->first=0;
+    need=1;
 
-    if (expr->is_unary)
+    for(f=e->no_ops-1;f>=0 && need>0;f--)
     {
-        if (token==TYPE_OPERAND)
+        need--;
+
+        if (IS_OPERATOR_TYPE(e->op[f].token))
         {
-            if (!LabelExpand(expr->text, result) && IsFinalPass())
-            {
-                sprintf(error,"Invalid value '%s'",expr->text);
-                return FALSE;
-            }
+            need+=e->op[f].is_unary ? 1 : 2;
+        }
 
-            expr = Pop(expr);
+        if (need==0)
+        {
+            e->first=f;
         }
-        else if (token==TYPE_LABEL)
+    }
+
+    return e;
+}
+
+
+/* Evaluate a single step.  sp is the top of the value stack, base its start.
+   Returns the new top of the stack, or NULL on error.
+*/
+static long *EvalOp(const ExprOp *op, long *sp, long *base)
+{
+    if (op->token==TYPE_CONSTANT && !LabelShadowsConstants())
+    {
+        *sp++=op->value;
+    }
+    else if (op->token==TYPE_OPERAND || op->token==TYPE_CONSTANT)
+    {
+        if (!LabelExpand(op->text, sp) && IsFinalPass())
         {
-            const Label *label = NULL;
+            sprintf(error,"Invalid value '%s'",op->text);
+            return NULL;
+        }
 
-            if (IsFinalPass())
-            {
-                if (!(label = LabelFind(expr->text, ANY_LABEL)))
-                {
-                    sprintf(error,"Undefined label '%s'",expr->text);
-                    return FALSE;
-                }
-            }
+        sp++;
+    }
+    else if (op->is_unary)
+    {
+        long val;
 
-            *result = (label == NULL ? 0 : label->value);
-            expr = Pop(expr);
+        if (sp==base)
+        {
+            sprintf(error,"Operator '%s' expects an argument",
+                                ToString(op->token));
+            return NULL;
         }
-        else
+
+        val=sp[-1];
+
+        switch(op->token)
         {
-            long val;
+            case TYPE_NOT:
+                sp[-1]=~val;
+                break;
 
-            expr=Pop(expr);
+            case TYPE_UNARY_PLUS:
+                sp[-1]=+val;
+                break;
 
-            if (!expr || !EvalPostfix(&expr,&val))
-            {
-                sprintf(error,"Operator '%s' expects an argument",
-                                ToString(token));
-                *stack=expr;
-                return FALSE;
-            }
+            case TYPE_UNARY_NEG:
+                sp[-1]=-val;
+                break;
 
-            switch(token)
-            {
-                case TYPE_NOT:
-                    *result=~val;
-                    break;
-
-                case TYPE_UNARY_PLUS:
-                    *result=+val;
-                    break;
-
-                case TYPE_UNARY_NEG:
-                    *result=-val;
-                    break;
-
-                default:
-                    sprintf(error,"Execpected unary token '%s' processed",
-                                        ToString(token));
-                    *stack=expr;
-                    return FALSE;
-                    break;
-            }
+            default:
+                sprintf(error,"Execpected unary token '%s' processed",
+                                    ToString(op->token));
+                return NULL;
+                break;
         }
     }
     else
     {
-        long left,right;
+        long left,right,result;
 
-        expr=Pop(expr);
-
-        if (!expr || !EvalPostfix(&expr,&right))
+        if (sp-base<2)
         {
             sprintf(error,"Operator '%s' expects two "
                                 "arguments (unknown label?)",
-                                ToString(token));
-            *stack=expr;
-            return FALSE;
+                                ToString(op->token));
+            return NULL;
         }
 
-        if (!expr || !EvalPostfix(&expr,&left))
-        {
-            sprintf(error,"Operator '%s' expects two "
-                                "arguments (unknown label?)",
-                                ToString(token));
-            *stack=expr;
-            return FALSE;
-        }
+        right=*--sp;
+        left=sp[-1];
 
-        switch(token)
+        switch(op->token)
         {
             case TYPE_DIVIDE:
-                *result=left/right;
+                result=left/right;
                 break;
 
             case TYPE_MULTIPLY:
-                *result=left*right;
+                result=left*right;
                 break;
 
             case TYPE_ADD:
-                *result=left+right;
+                result=left+right;
                 break;
 
             case TYPE_SUBTRACT:
-                *result=left-right;
+                result=left-right;
                 break;
 
             case TYPE_AND:
-                *result=left&right;
+                result=left&right;
                 break;
 
             case TYPE_OR:
-                *result=left|right;
+                result=left|right;
                 break;
 
             case TYPE_BOOL_AND:
-                *result=left&&right;
+                result=left&&right;
                 break;
 
             case TYPE_BOOL_OR:
-                *result=left||right;
+                result=left||right;
                 break;
 
             case TYPE_XOR:
-                *result=left^right;
+                result=left^right;
                 break;
 
             case TYPE_SHIFTL:
@@ -591,11 +637,10 @@ static int EvalPostfix(Stack **stack, long *result)
                 {
                     sprintf(error,"Cannot shift left by a "
                                         "negative number (%ld)",right);
-                    *stack=expr;
-                    return FALSE;
+                    return NULL;
                 }
 
-                *result=left<<right;
+                result=left<<right;
                 break;
 
             case TYPE_SHIFTR:
@@ -603,52 +648,127 @@ static int EvalPostfix(Stack **stack, long *result)
                 {
                     sprintf(error,"Cannot shift right by a "
                                         "negative number (%ld)",right);
-                    *stack=expr;
-                    return FALSE;
+                    return NULL;
                 }
 
-                *result=left>>right;
+                result=left>>right;
                 break;
 
             case TYPE_EQUALITY:
-                *result=left==right;
+                result=left==right;
                 break;
 
             case TYPE_INEQUALITY:
-                *result=left!=right;
+                result=left!=right;
                 break;
 
             case TYPE_LT:
-                *result=left<right;
+                result=left<right;
                 break;
 
             case TYPE_GT:
-                *result=left>right;
+                result=left>right;
                 break;
 
             case TYPE_LTEQ:
-                *result=left<=right;
+                result=left<=right;
                 break;
 
             case TYPE_GTEQ:
-                *result=left>=right;
+                result=left>=right;
                 break;
 
             default:
                 sprintf(error,"Unexpected binary token '%s' processed",
-                                ToString(token));
-                *stack=expr;
-                return FALSE;
+                                ToString(op->token));
+                return NULL;
                 break;
         }
+
+        sp[-1]=result;
+    }
+
+    return sp;
+}
+
+
+static int Run(CompiledExpr *e, long *result)
+{
+    const ExprOp *root;
+    long *sp;
+    int f;
+
+    if (e->no_ops==0)
+    {
+        sprintf(error,"Called with empty postfix stack");
+        return FALSE;
     }
 
-    *stack=expr;
+    root=e->op+e->no_ops-1;
+    sp=e->stack;
+
+    for(f=e->first;f<e->no_ops;f++)
+    {
+        if (!(sp=EvalOp(e->op+f,sp,e->stack)))
+        {
+            /* A failure inside an operator's arguments is reported
+               against the outermost operator
+            */
+            if (e->op+f!=root && IS_OPERATOR_TYPE(root->token))
+            {
+                if (root->is_unary)
+                {
+                    sprintf(error,"Operator '%s' expects an argument",
+                                        ToString(root->token));
+                }
+                else
+                {
+                    sprintf(error,"Operator '%s' expects two "
+                                        "arguments (unknown label?)",
+                                        ToString(root->token));
+                }
+            }
+
+            return FALSE;
+        }
+    }
+
+    *result=sp[-1];
 
     return TRUE;
 }
 
 
+/* Find an expression in the cache, compiling and caching it if needed.
+   Cached expressions are kept in the permanent arena, others only last as
+   long as the current line.
+*/
+static CompiledExpr *Get(const char *expr)
+{
+    CompiledExpr *e=NULL;
+
+    if (cache)
+    {
+        for(e=*cache;e && strcmp(e->text,expr)!=0;e=e->next)
+            ;
+    }
+
+    if (!e)
+    {
+        if (!(e=Compile(expr,cache ? ArenaPermanent() : ArenaLine())))
+            return NULL;
+
+        if (cache)
+        {
+            e->next=*cache;
+            *cache=e;
+        }
+    }
+
+    return e;
+}
+
+
 /* ---------------------------------------- INTERFACES
 */
 
@@ -667,20 +787,51 @@ int ExprConvert(int no_bits, long value)
 
 int ExprEval(const char *expr, long *result)
 {
-    Stack *output=ToPostfix(expr);
-    int ret;
+    static StatsCounter stats=STATS_COUNTER("ExprEval");
+    CompiledExpr *e;
+    double start=0;
+    int ret=FALSE;
 
-    if (!output)
-        return FALSE;
+    STATS_START(start);
 
-    ret=EvalPostfix(&output,result);
+    if ((e=Get(expr)))
+    {
+        ret=Run(e,result);
+    }
 
-    ClearStack(output);
+    STATS_END(stats,start);
 
     return ret;
 }
 
 
+int ExprUsesPC(const char *expr)
+{
+    CompiledExpr *e;
+    int uses=FALSE;
+    int f;
+
+    /* If it doesn't compile say it does, so the caller evaluates it and
+       reports the error.
+    */
+    if (!(e=Get(expr)))
+        return TRUE;
+
+    for(f=e->first;f<e->no_ops && !uses;f++)
+    {
+        uses=(e->op[f].token==TYPE_OPERAND && strcmp(e->op[f].text,"$")==0);
+    }
+
+    return uses;
+}
+
+
+void ExprSetCache(CompiledExpr **list)
+{
+    cache=list;
+}
+
+
 /* Gets a readable reason for an error from ExprEval() or ExprParse.
 */
 const char *ExprError(void)
@@ -26,6 +26,14 @@
 #ifndef CASM_EXPR_H
 #define CASM_EXPR_H
 
+/* ---------------------------------------- TYPES
+*/
+
+/* An expression compiled into postfix steps
+*/
+typedef struct compiled_expr CompiledExpr;
+
+
 /* ---------------------------------------- INTERFACES
 */
 
@@ -41,11 +49,26 @@ int     ExprConvert(int no_bits, long value);
 int     ExprEval(const char *expr, long *result);
 
 
+/* Returns TRUE if the expression refers to the PC ($), and so can give a
+   different result as code is written.
+*/
+int     ExprUsesPC(const char *expr);
+
+
 /* Gets a readable reason for an error from ExprEval() or ExprParse.
 */
 const char *ExprError(void);
 
 
+/* Sets a list to cache compiled expressions in.  While set ExprEval() keeps
+   the expressions it compiles in the list and reuses them when asked to
+   evaluate the same text again.  Pass NULL to stop caching, in which case
+   expressions are compiled for each evaluation.  Cached expressions live in
+   the permanent arena and are never freed.
+*/
+void    ExprSetCache(CompiledExpr **list);
+
+
 #endif
 
 /*
@@ -31,6 +31,7 @@
 #include "label.h"
 #include "parse.h"
 #include "cmd.h"
+#include "hash.h"
 #include "codepage.h"
 #include "varchar.h"
 
@@ -1897,11 +1898,70 @@ static const OpcodeTable implied_opcodes[] =
 };
 
 
+/* ---------------------------------------- OPCODE INDEX
+*/
+
+/* The opcode tables are indexed by name the first time the CPU is
+   initialised.  Only one of the table pointers is set for each name.
+*/
+typedef struct
+{
+    const OpcodeTable    *implied;
+    const HandlerTable   *handler;
+} OpcodeIndex;
+
+static HashTable        *opcode_index;
+
+
+/* Adds an opcode to the index.  Names already indexed are left alone, so the
+   tables are added in the order they used to be searched in.
+*/
+static void AddOpcode(const char *op, const OpcodeTable *implied,
+                      const HandlerTable *handler)
+{
+    OpcodeIndex *i;
+
+    if (HashFind(opcode_index, op))
+    {
+        return;
+    }
+
+    i = Malloc(sizeof *i);
+    i->implied = implied;
+    i->handler = handler;
+
+    HashAdd(opcode_index, op, i);
+}
+
+
+static void IndexOpcodes(void)
+{
+    int f;
+
+    opcode_index = HashCreate();
+
+    for(f = 0; implied_opcodes[f].op; f++)
+    {
+        AddOpcode(implied_opcodes[f].op, implied_opcodes + f, NULL);
+    }
+
+    for(f = 0; handler_table[f].op; f++)
+    {
+        AddOpcode(handler_table[f].op, NULL, handler_table + f);
+    }
+}
+
+
 /* ---------------------------------------- PUBLIC INTERFACES
 */
 
 void Init_GBCPU(void)
 {
+    if (!opcode_index)
+    {
+        IndexOpcodes();
+    }
+
 }
 
 
@@ -1921,36 +1981,35 @@ CommandStatus SetOption_GBCPU(int opt, int argc, char *argv[], int quoted[],
 CommandStatus Handler_GBCPU(const char *label, int argc, char *argv[],       
                            int quoted[], char *err, size_t errsize)
 {
-    int f;
+    const OpcodeIndex *op = HashFind(opcode_index, argv[0]);
+
+    if (!op)
+    {
+        return CMD_NOT_KNOWN;
+    }
 
     /* Check for simple (implied addressing) opcodes
     */
-    for(f = 0; implied_opcodes[f].op; f++)
+    if (op->implied)
     {
-        if (CompareString(argv[0], implied_opcodes[f].op))
-        {
-            int r;
+        int r;
 
-            PCWrite(implied_opcodes[f].code[0]);
+        PCWrite(op->implied->code[0]);
 
-            for(r = 1; implied_opcodes[f].code[r]; r++)
-            {
-                PCWrite(implied_opcodes[f].code[r]);
-            }
-
-            return CMD_OK;
+        for(r = 1; op->implied->code[r]; r++)
+        {
+            PCWrite(op->implied->code[r]);
         }
+
+        return CMD_OK;
     }
 
     /* Check for other opcodes
     */
-    for(f = 0; handler_table[f].op; f++)
+    if (op->handler)
     {
-        if (CompareString(argv[0], handler_table[f].op))
-        {
-            return handler_table[f].cmd(label, argc, argv,
-                                        quoted, err, errsize);;
-        }
+        return op->handler->cmd(label, argc, argv,
+                                quoted, err, errsize);;
     }
 
     return CMD_NOT_KNOWN;
@@ -116,6 +116,27 @@ static int PokeS(Byte *mem, int addr, const char *str, int maxlen)
 }
 
 
+static unsigned CalcChecksum(unsigned bank, int p, int len, unsigned csum)
+{
+    while(len > 0)
+    {
+        ulong run;
+        ulong f;
+        const Byte *mem = MemoryView(bank, p, len, &run);
+
+        for(f = 0; f < run; f++)
+        {
+            csum += mem[f];
+        }
+
+        p += run;
+        len -= run;
+    }
+
+    return csum;
+}
+
+
 static int PokeCode(Byte *mem, int addr, const int *code)
 {
     while(*code != -1)
@@ -258,7 +279,7 @@ int GBOutput(const char *filename, const char *filename_bank,
         rom_size = (count / 4) + 1;
     }
 
-    mem = MemoryGetBlock(banks[f], 0, 0x10000);
+    mem = MemoryGetBlock(banks[0], 0, 0x8000);
 
     /* Create the log
     */
@@ -414,10 +435,7 @@ int GBOutput(const char *filename, const char *filename_bank,
 
         for(r = 1; r < count; r++)
         {
-            for(f = 0x4000; f < 0x8000; f++)
-            {
-                global_csum += MemoryReadBank(banks[r], f);
-            }
+            global_csum = CalcChecksum(banks[r], 0x4000, 0x4000, global_csum);
         }
     }
 
@@ -438,11 +456,7 @@ int GBOutput(const char *filename, const char *filename_bank,
 
         for(r = 1; r < count; r++)
         {
-            Byte *bank = MemoryGetBlock(banks[r], 0x4000, 0x4000);
-
-            fwrite(bank, 0x4000, 1, fp);
-
-            free(bank);
+            MemoryWriteFile(fp, banks[r], 0x4000, 0x4000);
         }
     }
 
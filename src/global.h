@@ -40,6 +40,17 @@
 #define CASM_MAX_LINE_LENGTH 4096
 
 
+/* State that each thread loading sources needs its own copy of.  Without
+   C11 thread storage the sources are loaded on a single thread.
+*/
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define CASM_THREAD_LOCAL _Thread_local
+#define CASM_HAVE_THREAD_LOCAL
+#else
+#define CASM_THREAD_LOCAL
+#endif
+
+
 /* ---------------------------------------- GLOBAL TYPES
 */
 typedef unsigned long ulong;
@@ -0,0 +1,212 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Simple case insensitive hash table.  Uses open addressing with linear
+    probing, and the table is doubled in size once it gets half full.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "global.h"
+#include "hash.h"
+
+
+/* ---------------------------------------- TYPES
+*/
+
+#define INITIAL_SIZE    16
+
+typedef struct
+{
+    unsigned    hash;
+    const char  *key;
+    void        *data;
+} HashSlot;
+
+
+struct hashtable
+{
+    HashSlot    *slot;
+    int         size;
+    int         count;
+};
+
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+
+/* Find the slot for a key.  Returns the empty slot the key should go in if it
+   isn't found.
+*/
+static HashSlot *FindSlot(HashSlot *slot, int size,
+                          const char *key, unsigned hash)
+{
+    unsigned mask = size - 1;
+    unsigned f = hash & mask;
+
+    while(slot[f].key)
+    {
+        if (slot[f].hash == hash && CompareString(slot[f].key, key))
+        {
+            break;
+        }
+
+        f = (f + 1) & mask;
+    }
+
+    return slot + f;
+}
+
+
+static void Grow(HashTable *table)
+{
+    HashSlot *old = table->slot;
+    int old_size = table->size;
+    int f;
+
+    table->size = old_size ? old_size * 2 : INITIAL_SIZE;
+    table->slot = Malloc((sizeof *table->slot) * table->size);
+
+    for(f = 0; f < table->size; f++)
+    {
+        table->slot[f].key = NULL;
+    }
+
+    for(f = 0; f < old_size; f++)
+    {
+        if (old[f].key)
+        {
+            *FindSlot(table->slot, table->size,
+                      old[f].key, old[f].hash) = old[f];
+        }
+    }
+
+    free(old);
+}
+
+
+/* ---------------------------------------- INTERFACES
+*/
+
+HashTable *HashCreate(void)
+{
+    HashTable *t;
+
+    t = Malloc(sizeof *t);
+
+    t->slot = NULL;
+    t->size = 0;
+    t->count = 0;
+
+    return t;
+}
+
+
+unsigned HashKey(const char *key)
+{
+    unsigned hash = 2166136261u;
+
+    while(*key)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)*key++);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+void *HashFind(HashTable *table, const char *key)
+{
+    HashSlot *s;
+
+    if (!table || table->count == 0)
+    {
+        return NULL;
+    }
+
+    s = FindSlot(table->slot, table->size, key, HashKey(key));
+
+    return s->key ? s->data : NULL;
+}
+
+
+void HashAdd(HashTable *table, const char *key, void *data)
+{
+    unsigned hash = HashKey(key);
+    HashSlot *s;
+
+    if ((table->count + 1) * 2 > table->size)
+    {
+        Grow(table);
+    }
+
+    s = FindSlot(table->slot, table->size, key, hash);
+
+    if (!s->key)
+    {
+        table->count++;
+    }
+
+    s->hash = hash;
+    s->key = key;
+    s->data = data;
+}
+
+
+int HashCount(HashTable *table)
+{
+    return table ? table->count : 0;
+}
+
+
+void HashClear(HashTable *table)
+{
+    int f;
+
+    if (table)
+    {
+        for(f = 0; f < table->size; f++)
+        {
+            table->slot[f].key = NULL;
+        }
+
+        table->count = 0;
+    }
+}
+
+
+void HashFree(HashTable *table)
+{
+    if (table)
+    {
+        free(table->slot);
+        free(table);
+    }
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
@@ -0,0 +1,76 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Simple case insensitive hash table.
+
+*/
+
+#ifndef CASM_HASH_H
+#define CASM_HASH_H
+
+typedef struct hashtable HashTable;
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Create a new hash table.
+*/
+HashTable       *HashCreate(void);
+
+
+/* Calculate the hash for a key.  The hash is case insensitive, in the same
+   way as CompareString().
+*/
+unsigned        HashKey(const char *key);
+
+
+/* Find the data stored against a key.  Returns NULL if the key is not in the
+   table.
+*/
+void            *HashFind(HashTable *table, const char *key);
+
+
+/* Store data against a key, replacing any previous data for the key.  The key
+   is not copied, so must remain valid while it is in the table.  Generally
+   this means it should point into the data being stored.
+*/
+void            HashAdd(HashTable *table, const char *key, void *data);
+
+
+/* Number of keys held in the table.
+*/
+int             HashCount(HashTable *table);
+
+
+/* Remove all keys from the table.  The stored data is not touched.
+*/
+void            HashClear(HashTable *table);
+
+
+/* Free the table.  The stored data is not touched.
+*/
+void            HashFree(HashTable *table);
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
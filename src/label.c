@@ -29,18 +29,27 @@
 #include "global.h"
 #include "codepage.h"
 #include "stack.h"
+#include "hash.h"
 #include "label.h"
+#include "arena.h"
+#include "stats.h"
 
 
 /* ---------------------------------------- TYPES
 */
 
+/* Number of locals a global can hold before they're indexed with a hash
+   table.  Below this a simple scan is quicker.
+*/
+#define LOCAL_INDEX_THRESHOLD   16
+
 typedef struct global
 {
     Label               label;
     Label               *locals;
     int                 no_locals;
     int                 local_size;
+    HashTable           *local_index;
     struct global       *next;
     struct global       *next_scope;
 } GlobalLabel;
@@ -52,12 +61,30 @@ static GlobalLabel      *head;
 static GlobalLabel      *tail;
 static GlobalLabel      *scope;
 
+/* Globals are held in definition order in the head/tail list for dumping, and
+   indexed by name for lookups.
+*/
+static HashTable        *globals;
+
 static char             namespace[MAX_LABEL_SIZE + 1];
 
 static Stack            *stack;
 
 static int              address24 = FALSE;
 
+/* Count of labels defined with names that could be read as a constant
+*/
+static int              numeric_names;
+
+/* Dependency recording.  The generation changes whenever a new label could
+   change what an existing name refers to, so recorded labels are only
+   trusted while it stays the same.
+*/
+static LabelDeps        *recording;
+static unsigned         generation;
+
+static long             no_labels;
+
 
 /* ---------------------------------------- PRIVATE FUNCTIONS
 */
@@ -110,10 +137,41 @@ static char *ReadName(FILE *fp, char *name)
 }
 
 
+static int IsNumericName(const char *p)
+{
+    return *p && strchr("0123456789$%", *p);
+}
+
+
+static void FreeLocalIndex(GlobalLabel *in)
+{
+    HashFree(in->local_index);
+    in->local_index = NULL;
+}
+
+
+static void IndexLocals(GlobalLabel *in)
+{
+    int f;
+
+    in->local_index = HashCreate();
+
+    for(f = 0; f < in->no_locals; f++)
+    {
+        HashAdd(in->local_index, in->locals[f].name, in->locals + f);
+    }
+}
+
+
 static Label *FindLocal(const char *p, GlobalLabel *in)
 {
     int f;
 
+    if (in->local_index)
+    {
+        return HashFind(in->local_index, p);
+    }
+
     for(f = 0; f < in->no_locals; f++)
     {
         if (CompareString(in->locals[f].name, p))
@@ -128,19 +186,11 @@ static Label *FindLocal(const char *p, GlobalLabel *in)
 
 static GlobalLabel *FindGlobal(const char *p)
 {
-    GlobalLabel *g = head;
+    static StatsCounter stats = STATS_COUNTER("FindGlobal");
 
-    while(g)
-    {
-        if (CompareString(g->label.name, p))
-        {
-            return g;
-        }
-
-        g = g->next;
-    }
+    STATS_COUNT(stats);
 
-    return NULL;
+    return HashFind(globals, p);
 }
 
 
@@ -167,22 +217,88 @@ static Label *Find(const char *p, LabelType type)
 }
 
 
+/* Set up a new label's pass tracking.  A label appearing after the first pass
+   may be one that earlier code failed to find, so needs another pass.
+*/
+static void Created(Label *l)
+{
+    no_labels++;
+    STATS_PEAK("labels", no_labels);
+
+    l->set_pass = GetCurrentPass();
+    l->read_pass = 0;
+    l->read_value = 0;
+
+    if (!IsFirstPass())
+    {
+        PassUnstable(l->name);
+    }
+}
+
+
+static void Assign(Label *l, long value)
+{
+    l->value = value;
+    l->set_pass = GetCurrentPass();
+}
+
+
+static void Record(Label *l)
+{
+    LabelDeps *d = recording;
+    LabelDep *dep;
+
+    if (d->count == d->size)
+    {
+        d->size = d->size ? d->size * 2 : 4;
+        d->dep = Realloc(d->dep, (sizeof *d->dep) * d->size);
+    }
+
+    dep = d->dep + d->count++;
+
+    /* Find() only finds locals in the current scope
+    */
+    if (l->type == LOCAL_LABEL)
+    {
+        dep->global = scope;
+        dep->index = l - scope->locals;
+    }
+    else
+    {
+        dep->global = l;
+        dep->index = -1;
+    }
+
+    dep->value = l->value;
+}
+
+
+static Label *Recorded(const LabelDep *dep)
+{
+    GlobalLabel *g = dep->global;
+
+    return dep->index < 0 ? &g->label : g->locals + dep->index;
+}
+
+
 static void AddGlobal(const char *p, long value)
 {
     GlobalLabel *l = FindGlobal(p);
 
     if (!l)
     {
-        l = Malloc(sizeof *l);
+        l = ArenaAlloc(ArenaPermanent(), sizeof *l);
 
         CopyStr(l->label.name, p, sizeof l->label.name);
 
         l->label.value = value;
         l->label.type = GLOBAL_LABEL;
+        Created(&l->label);
 
         l->no_locals = 0;
         l->locals = NULL;
         l->local_size = 0;
+        l->local_index = NULL;
         l->next = NULL;
         l->next_scope = NULL;
 
@@ -197,10 +313,23 @@ static void AddGlobal(const char *p, long value)
         {
             head = l;
         }
+
+        if (!globals)
+        {
+            globals = HashCreate();
+        }
+
+        HashAdd(globals, l->label.name, l);
+
+        if (IsNumericName(l->label.name))
+        {
+            numeric_names++;
+            generation++;
+        }
     }
     else
     {
-        l->label.value = value;
+        Assign(&l->label, value);
     }
 
     scope = l;
@@ -224,11 +353,15 @@ static void AddLocal(const char *p, int value)
     {
         if (scope->no_locals >= scope->local_size)
         {
-            scope->local_size += 32;
+            scope->local_size = scope->local_size ? scope->local_size * 2 : 8;
 
             scope->locals =
                 Realloc(scope->locals,
                               (sizeof *scope->locals) * scope->local_size);
+
+            /* The locals have moved, so any index is now invalid
+            */
+            FreeLocalIndex(scope);
         }
 
         i = scope->no_locals++;
@@ -236,10 +369,34 @@ static void AddLocal(const char *p, int value)
         CopyStr(scope->locals[i].name, p, sizeof scope->locals[i].name);
         scope->locals[i].value = value;
         scope->locals[i].type = LOCAL_LABEL;
+        Created(scope->locals + i);
+
+        if (scope->local_index)
+        {
+            HashAdd(scope->local_index, scope->locals[i].name,
+                                        scope->locals + i);
+        }
+        else if (scope->no_locals > LOCAL_INDEX_THRESHOLD)
+        {
+            IndexLocals(scope);
+        }
+
+        if (IsNumericName(scope->locals[i].name))
+        {
+            numeric_names++;
+            generation++;
+        }
+
+        /* The local now hides any global of the same name
+        */
+        if (FindGlobal(p))
+        {
+            generation++;
+        }
     }
     else
     {
-        l->value = value;
+        Assign(l, value);
     }
 }
 
@@ -255,6 +412,46 @@ static int ParseBase(const char *str, int base, long *result, char last)
 }
 
 
+static int ParseConstant(const char *expr, long *result)
+{
+    size_t len;
+    char first, last;
+    int found;
+
+    len = strlen(expr);
+    first = expr[0];
+    last = expr[len - 1];
+
+    if (first == '$')
+    {
+        found = ParseBase(expr + 1, 16, result, '\0');
+    }
+    else if (last == 'h' || last == 'H')
+    {
+        found = ParseBase(expr, 16, result, last);
+    }
+    else if (first == '%')
+    {
+        found = ParseBase(expr + 1, 2, result, '\0');
+    }
+    else if (last == 'b' || last == 'B')
+    {
+        found = ParseBase(expr, 2, result, last);
+    }
+    else if (first == '\'' && last == '\'' && len == 3)
+    {
+        *result = CodepageConvert(expr[1]);
+        found = TRUE;
+    }
+    else
+    {
+        found = ParseBase(expr, 0, result, '\0');
+    }
+
+    return found;
+}
+
+
 /* ---------------------------------------- INTERFACES
 */
 
@@ -277,19 +474,29 @@ void LabelClear(void)
             free(tmp->locals);
         }
 
-        free(tmp);
+        /* The label itself is in the permanent arena
+        */
+        FreeLocalIndex(tmp);
     }
 
     head = NULL;
     tail = NULL;
+    numeric_names = 0;
+    no_labels = 0;
+    generation++;
+
+    HashClear(globals);
 }
 
 
 int LabelExpand(const char *expr, long *result)
 {
+    static StatsCounter stats = STATS_COUNTER("LabelExpand");
     Label *label;
     int found = FALSE;
 
+    STATS_COUNT(stats);
+
     /* Check for special single-characters
     */
     if (expr[0] && !expr[1])
@@ -299,6 +506,11 @@ int LabelExpand(const char *expr, long *result)
             /* Current PC
             */
             case '$':
+                if (recording)
+                {
+                    recording->uses_pc = TRUE;
+                }
+
                 if (address24)
                 {
                     *result = CurrentBank() << 16 | PC();
@@ -321,41 +533,38 @@ int LabelExpand(const char *expr, long *result)
     {
         *result = label->value;
         found = TRUE;
-    }
-
-    if (!found)
-    {
-        size_t len;
-        char first, last;
 
-        len = strlen(expr);
-        first = expr[0];
-        last = expr[len - 1];
-
-        if (first == '$')
-        {
-            found = ParseBase(expr + 1, 16, result, '\0');
-        }
-        else if (last == 'h' || last == 'H')
+        /* Remember the value of a label used before being set this pass
+        */
+        if (label->set_pass != GetCurrentPass() &&
+                            label->read_pass != GetCurrentPass())
         {
-            found = ParseBase(expr, 16, result, last);
+            label->read_pass = GetCurrentPass();
+            label->read_value = label->value;
         }
-        else if (first == '%')
-        {
-            found = ParseBase(expr + 1, 2, result, '\0');
-        }
-        else if (last == 'b' || last == 'B')
+
+        if (recording)
         {
-            found = ParseBase(expr, 2, result, last);
+            Record(label);
         }
-        else if (first == '\'' && last == '\'' && len == 3)
+    }
+
+    if (!found)
+    {
+        found = ParseConstant(expr, result);
+
+        /* Names that aren't labels yet could become one
+        */
+        if (recording && !IsNumericName(expr))
         {
-            *result = CodepageConvert(expr[1]);
-            found = TRUE;
+            recording->complete = FALSE;
         }
-        else
+
+        /* On the first pass this is most likely a forward reference
+        */
+        if (!found && IsFirstPass())
         {
-            found = ParseBase(expr, 0, result, '\0');
+            PassUnstable(expr);
         }
     }
 
@@ -363,6 +572,26 @@ int LabelExpand(const char *expr, long *result)
 }
 
 
+int LabelConstant(const char *expr, long *result)
+{
+    /* Only numbers are considered, as character constants depend on the
+       codepage in use.
+    */
+    if (!IsNumericName(expr) || (expr[0] == '$' && !expr[1]))
+    {
+        return FALSE;
+    }
+
+    return ParseConstant(expr, result);
+}
+
+
+int LabelShadowsConstants(void)
+{
+    return numeric_names > 0;
+}
+
+
 int LabelSanatise(char *label, LabelType *type)
 {
     int status = TRUE;
@@ -407,7 +636,7 @@ void LabelSet(const char *label, long value, LabelType type)
         case ANY_LABEL:
             if (!scope || CompareString(scope->label.name, label))
             {
-                scope->label.value = value;
+                Assign(&scope->label, value);
             }
             else
             {
@@ -441,13 +670,24 @@ void LabelScopePush(const char *name, long value)
 
 void LabelScopePop(void)
 {
-    scope = StackPop(stack);
+    /* On the final pass nothing will look in a popped scope again, so drop
+       its index in one go.  The locals are kept for the label dump.
+    */
+    if (scope && IsFinalPass())
+    {
+        FreeLocalIndex(scope);
+    }
 
-    if (!scope)
+    /* The scope popped back to may be none, if no global label had been
+       set when it was pushed
+    */
+    if (StackSize(stack) == 0)
     {
         fprintf(stderr, "ERROR: Popping the global scope left it empty");
         exit(EXIT_FAILURE);
     }
+
+    scope = StackPop(stack);
 }
 
 
@@ -466,11 +706,14 @@ const char *LabelCreateNamespace(void)
         LabelResetNamespace();
     }
 
+    /* The digits count up with the first as the least significant, carrying
+       into the next
+    */
     f = 1;
 
     while(f < MAX_LABEL_SIZE && namespace[f] == '9')
     {
-        f++;
+        namespace[f++] = '0';
     }
 
     if (f < MAX_LABEL_SIZE)
@@ -496,6 +739,103 @@ void LabelResetNamespace(void)
 }
 
 
+void LabelEndPass(void)
+{
+    GlobalLabel *g;
+    int pass;
+    int f;
+
+    pass = GetCurrentPass();
+
+    for(g = head; g; g = g->next)
+    {
+        if (g->label.read_pass == pass &&
+                        g->label.read_value != g->label.value)
+        {
+            PassUnstable(g->label.name);
+            return;
+        }
+
+        for(f = 0; f < g->no_locals; f++)
+        {
+            if (g->locals[f].read_pass == pass &&
+                        g->locals[f].read_value != g->locals[f].value)
+            {
+                PassUnstable(g->locals[f].name);
+                return;
+            }
+        }
+    }
+}
+
+
+void LabelRecordStart(LabelDeps *deps)
+{
+    deps->count = 0;
+    deps->uses_pc = FALSE;
+    deps->complete = TRUE;
+    deps->generation = generation;
+    recording = deps;
+}
+
+
+int LabelRecordStop(void)
+{
+    int ok;
+
+    ok = recording->complete && recording->generation == generation;
+    recording = NULL;
+
+    return ok;
+}
+
+
+int LabelDepsUnchanged(const LabelDeps *deps)
+{
+    int pass;
+    int f;
+
+    if (deps->generation != generation)
+    {
+        return FALSE;
+    }
+
+    for(f = 0; f < deps->count; f++)
+    {
+        if (Recorded(deps->dep + f)->value != deps->dep[f].value)
+        {
+            return FALSE;
+        }
+    }
+
+    /* Note any reads before the label has been set, as LabelExpand() would
+    */
+    pass = GetCurrentPass();
+
+    for(f = 0; f < deps->count; f++)
+    {
+        Label *l = Recorded(deps->dep + f);
+
+        if (l->set_pass != pass && l->read_pass != pass)
+        {
+            l->read_pass = pass;
+            l->read_value = l->value;
+        }
+    }
+
+    return TRUE;
+}
+
+
+void LabelDepsFree(LabelDeps *deps)
+{
+    free(deps->dep);
+    deps->dep = NULL;
+    deps->count = 0;
+    deps->size = 0;
+}
+
+
 void LabelDump(FILE *fp, int dump_private)
 {
     GlobalLabel *g = head;
@@ -45,16 +45,46 @@ typedef enum
 } LabelType;
 
 
-/* A label
+/* A label.  set_pass, read_pass and read_value are used to spot a pass that
+   used a label before it was set, and got a value that then changed.
 */
 typedef struct
 {
     char        name[MAX_LABEL_SIZE+1];
     int         value;
     LabelType   type;
+    int         set_pass;
+    int         read_pass;
+    int         read_value;
 } Label;
 
 
+/* A label read while recording, and the value it had.  Locals can move, so
+   labels are held as the global they belong to and an index into its locals,
+   or -1 for the global itself.
+*/
+typedef struct
+{
+    void        *global;
+    int         index;
+    int         value;
+} LabelDep;
+
+
+/* The labels a command read, recorded with LabelRecordStart().  Initialise
+   with all members zero.
+*/
+typedef struct
+{
+    LabelDep    *dep;
+    int         count;
+    int         size;
+    int         uses_pc;
+    int         complete;
+    unsigned    generation;
+} LabelDeps;
+
+
 /* Clear labels
 */
 void            LabelClear(void);
@@ -65,6 +95,19 @@ void            LabelClear(void);
 int             LabelExpand(const char *expr, long *result);
 
 
+/* Parse a number without considering labels.  Returns TRUE if expr is a
+   number whose value can't change from one pass to the next.
+*/
+int             LabelConstant(const char *expr, long *result);
+
+
+/* Returns TRUE if a label has been defined with a name that LabelConstant()
+   could accept.  As labels take priority over constants in LabelExpand(), a
+   constant is then no longer guaranteed to be one.
+*/
+int             LabelShadowsConstants(void);
+
+
 /* Utility to sanatise a label name, returning whether it's a global or local
    label.  Returns FALSE if the label is invalid, otherwise returns TRUE.
 */
@@ -111,6 +154,35 @@ const char      *LabelCreateNamespace(void);
 void            LabelResetNamespace(void);
 
 
+/* Record the labels read by LabelExpand() into deps until LabelRecordStop()
+   is called.  Anything already in deps is discarded.
+*/
+void            LabelRecordStart(LabelDeps *deps);
+
+
+/* Stop recording.  Returns FALSE if something was read that couldn't be
+   recorded, for instance a label that isn't defined yet.
+*/
+int             LabelRecordStop(void);
+
+
+/* Returns TRUE if every label in deps still has the value it was recorded
+   with.  If so the labels are treated as having been read again.
+*/
+int             LabelDepsUnchanged(const LabelDeps *deps);
+
+
+/* Free the memory used by deps.
+*/
+void            LabelDepsFree(LabelDeps *deps);
+
+
+/* Called at the end of a pass.  Calls PassUnstable() if any label was used
+   before it was set and the value used differs from the one it ended up with.
+*/
+void            LabelEndPass(void);
+
+
 /* Dump a formatted report of labels to the passed file pointer
 */
 void            LabelDump(FILE *fp, int dump_private);
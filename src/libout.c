@@ -116,22 +116,17 @@ int LibOutput(const char *filename, const char *filename_bank,
 
     for(f = 0; f < count; f++)
     {
-        Byte *mem;
         ulong min, max, len;
 
         min = GetLowWriteMarker(banks[f]);
         max = GetHighWriteMarker(banks[f]);
         len = max - min + 1;
 
-        mem = MemoryGetBlock(banks[f], min, len);
-
         WriteUlong(fp, banks[f]);
         WriteUlong(fp, min);
         WriteUlong(fp, len);
 
-        fwrite(mem, 1, len, fp);
-
-        free(mem);
+        MemoryWriteFile(fp, banks[f], min, len);
     }
 
     LabelWriteBlob(fp);
@@ -146,6 +141,7 @@ int LibLoad(const char *filename, LibLoadOption opt, int offset,
             char *error, size_t error_size)
 {
     char magic[CASM_LIBRARY_MAGIC_LEN + 1] = {0};
+    Byte buff[4096];
     FILE *fp;
     int count;
     int f;
@@ -179,11 +175,28 @@ int LibLoad(const char *filename, LibLoadOption opt, int offset,
 
         if (opt != LibLoadLabels)
         {
-            while(len-- > 0)
+            ulong addr = min + offset;
+
+            while(len > 0)
             {
-                MemoryWriteBank(bank, min + offset + len, fgetc(fp));
+                size_t num = len < sizeof buff ? len : sizeof buff;
+
+                num = fread(buff, 1, num, fp);
+
+                if (num == 0)
+                {
+                    break;
+                }
+
+                MemoryWriteBlock(bank, addr, buff, num);
+                addr += num;
+                len -= num;
             }
         }
+        else
+        {
+            fseek(fp, len, SEEK_CUR);
+        }
     }
 
     if (opt != LibLoadMemory)
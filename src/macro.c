@@ -29,8 +29,10 @@
 
 #include "global.h"
 #include "codepage.h"
-#include "varchar.h"
 #include "macro.h"
+#include "arena.h"
+#include "hash.h"
+#include "stats.h"
 
 
 /* ---------------------------------------- TYPES
@@ -48,13 +50,50 @@ static const ValueTable option_set[] =
 };
 
 
+/* A recorded line is compiled into a template of literal text and the
+   arguments to insert between them, so that playing it back doesn't have to
+   scan for arguments each time.  The template depends on the argument
+   character, so is compiled again if that's changed since.
+*/
+#define SEG_TEXT        -1
+#define SEG_ALL_ARGS    -2
+
+typedef struct
+{
+    int         arg;
+    const char  *text;
+    size_t      len;
+} Segment;
+
+typedef struct
+{
+    char        *text;
+    int         arg_char;
+    int         no_segments;
+    Segment     *segment;
+    int         parsed_ok;
+    Line        parsed;
+    CompiledExpr *exprs;
+    void        *command;
+} MacroLine;
+
+/* Blocks repeated with rept and irp are kept as macros without a name.  Their
+   lines are tokenised as they're recorded, and those that don't use the irp
+   argument are run from that each time round.  A block only gets its own
+   label scope if it defines labels.
+*/
 struct mdef
 {
     char        *name;
     int         no_args;
     char        **args;
     int         no_lines;
-    char        **lines;
+    int         lines_size;
+    MacroLine   *lines;
+    Arena       *arena;
+    int         repeat;
+    int         substitute;
+    int         scoped;
     struct mdef *next;
 };
 
@@ -65,7 +104,12 @@ struct macro
     int         line;
     int         argc;
     char        **argv;
+    size_t      *arglen;
     int         *quoted;
+    long        iteration;
+    long        count;
+    char        **items;
+    int         *item_quoted;
 };
 
 
@@ -73,6 +117,12 @@ struct macro
 */
 static MacroDef         *head;
 static MacroDef         *tail;
+static long             no_macros;
+
+/* Macros indexed by name, as any line that isn't a known command looks for
+   one
+*/
+static HashTable        *by_name;
 
 static const char       *arg_chars = "ABCDEFGHIJKLMNOPQRSTUVXYZ"
                                      "abcdefghijklmnopqrstuvxyz"
@@ -91,19 +141,7 @@ static struct
 */
 static MacroDef *FindMacro(const char *p)
 {
-    MacroDef *m = head;
-
-    while(m)
-    {
-        if (CompareString(m->name, p))
-        {
-            return m;
-        }
-
-        m = m->next;
-    }
-
-    return NULL;
+    return by_name ? HashFind(by_name, p) : NULL;
 }
 
 
@@ -128,11 +166,16 @@ static MacroDef *AddMacro(const char *p, int argc, char *argv[],
 
     if (!m)
     {
-        m = Malloc(sizeof *m);
+        m = ArenaAlloc(ArenaPermanent(), sizeof *m);
 
-        m->name = DupStr(p);
+        m->name = ArenaDupStr(ArenaPermanent(), p);
         m->no_lines = 0;
+        m->lines_size = 0;
         m->lines = NULL;
+        m->arena = ArenaPermanent();
+        m->repeat = FALSE;
+        m->substitute = TRUE;
+        m->scoped = TRUE;
         m->next = NULL;
 
         m->no_args = argc;
@@ -145,7 +188,8 @@ static MacroDef *AddMacro(const char *p, int argc, char *argv[],
         {
             int f;
 
-            m->args = Malloc((sizeof *m->args) * m->no_args);
+            m->args = ArenaAlloc(ArenaPermanent(),
+                                 (sizeof *m->args) * m->no_args);
 
             for(f = 0; f < argc; f++)
             {
@@ -156,7 +200,7 @@ static MacroDef *AddMacro(const char *p, int argc, char *argv[],
                     return NULL;
                 }
 
-                m->args[f] = DupStr(argv[f]);
+                m->args[f] = ArenaDupStr(ArenaPermanent(), argv[f]);
             }
         }
 
@@ -171,6 +215,16 @@ static MacroDef *AddMacro(const char *p, int argc, char *argv[],
         {
             head = m;
         }
+
+        if (!by_name)
+        {
+            by_name = HashCreate();
+        }
+
+        HashAdd(by_name, m->name, m);
+
+        no_macros++;
+        STATS_PEAK("macros", no_macros);
     }
     else
     {
@@ -182,47 +236,275 @@ static MacroDef *AddMacro(const char *p, int argc, char *argv[],
 }
 
 
-static void AddArg(Varchar *str, Macro *macro, int arg_no)
+/* Add an argument to an expanded line, returning its length.  Nothing is
+   written if out is NULL, so this can also be used to size the line.
+*/
+static size_t AddArg(char *out, const Macro *macro, int arg_no)
 {
-    if (arg_no < macro->argc)
+    size_t len = 0;
+    int quote;
+
+    if (arg_no < 0 || arg_no >= macro->argc)
+    {
+        return 0;
+    }
+
+    quote = macro->quoted[arg_no];
+
+    if (quote && out)
     {
-        int quote = macro->quoted[arg_no];
+        out[len] = quote;
+    }
+
+    len += quote != 0;
+
+    if (out)
+    {
+        memcpy(out + len, macro->argv[arg_no], macro->arglen[arg_no]);
+    }
+
+    len += macro->arglen[arg_no];
 
-        if (quote)
+    if (quote && out)
+    {
+        out[len] = quote == '(' ? ')' : quote;
+    }
+
+    len += quote != 0;
+
+    return len;
+}
+
+
+static int FindArg(MacroDef *def, const char *name)
+{
+    int f;
+
+    for(f = 0; f < def->no_args; f++)
+    {
+        if (CompareString(def->args[f], name))
         {
-            VarcharAddChar(str, quote);
+            return f;
         }
+    }
 
-        VarcharAdd(str, macro->argv[arg_no]);
+    return def->no_args;
+}
 
-        if (quote)
+
+/* Segments are gathered here while a line is compiled, then copied to the
+   line
+*/
+static Segment  *gather;
+static int      no_gather;
+static int      gather_size;
+
+
+static void AddSegment(int arg, const char *text, size_t len)
+{
+    if (no_gather == gather_size)
+    {
+        gather_size = gather_size ? gather_size * 2 : 16;
+        gather = Realloc(gather, (sizeof *gather) * gather_size);
+    }
+
+    gather[no_gather].arg = arg;
+    gather[no_gather].text = text;
+    gather[no_gather].len = len;
+    no_gather++;
+}
+
+
+/* Add an argument reference to the line being compiled, after any literal
+   text before it
+*/
+static void AddSlot(int arg, const char **text, size_t *len)
+{
+    if (*len)
+    {
+        AddSegment(SEG_TEXT, *text, *len);
+        *len = 0;
+    }
+
+    AddSegment(arg, NULL, 0);
+}
+
+
+/* Compile a recorded line into a template using the current argument
+   character.  This follows the same rules the line was once expanded with
+   directly, but records where arguments go rather than inserting them.
+*/
+static void CompileLine(MacroDef *def, MacroLine *ml)
+{
+    const char *line = ml->text;
+    const char *text = NULL;
+    size_t len = 0;
+    int slots = 0;
+    char num[64];
+    char arg[128];
+    int in_num = -1;
+    int in_arg = -1;
+    int rd = 0;
+
+    no_gather = 0;
+    ml->arg_char = options.arg_char;
+
+    if (!def->substitute)
+    {
+        ml->no_segments = 0;
+        ml->segment = NULL;
+        return;
+    }
+
+    while(line[rd])
+    {
+        if (line[rd] == '\\')
+        {
+            in_num = 0;
+            rd++;
+        }
+        else if (line[rd] == options.arg_char)
+        {
+            in_arg = 0;
+            rd++;
+        }
+        else if (in_num != -1)
         {
-            if (quote == '(')
+            if (isdigit((unsigned char)line[rd]) && in_num < 60)
             {
-                VarcharAddChar(str, ')');
+                num[in_num++] = line[rd++];
+            }
+            else if (in_num == 0 && line[rd] == '*')
+            {
+                rd++;
+                AddSlot(SEG_ALL_ARGS, &text, &len);
+                slots++;
+                in_num = -1;
             }
             else
             {
-                VarcharAddChar(str, quote);
+                num[in_num] = 0;
+                AddSlot(atoi(num), &text, &len);
+                slots++;
+                in_num = -1;
             }
         }
+        else if (in_arg != -1)
+        {
+            if (strchr(arg_chars, line[rd]) && in_arg < 125)
+            {
+                arg[in_arg++] = line[rd++];
+            }
+            else
+            {
+                arg[in_arg] = 0;
+                AddSlot(FindArg(def, arg) + 1, &text, &len);
+                slots++;
+                in_arg = -1;
+            }
+        }
+        else
+        {
+            if (len && text + len != line + rd)
+            {
+                AddSegment(SEG_TEXT, text, len);
+                len = 0;
+            }
+
+            if (!len)
+            {
+                text = line + rd;
+            }
+
+            len++;
+            rd++;
+        }
+    }
+
+    /* Check for arguments at the end of the line
+    */
+    if (in_num != -1)
+    {
+        num[in_num] = 0;
+        AddSlot(atoi(num), &text, &len);
+        slots++;
+    }
+
+    if (in_arg != -1)
+    {
+        arg[in_arg] = 0;
+        AddSlot(FindArg(def, arg) + 1, &text, &len);
+        slots++;
+    }
+
+    if (len)
+    {
+        AddSegment(SEG_TEXT, text, len);
+    }
+
+    /* Lines without arguments are simply played back as recorded
+    */
+    if (slots)
+    {
+        ml->no_segments = no_gather;
+        ml->segment = memcpy(ArenaAlloc(def->arena,
+                                        (sizeof *gather) * no_gather),
+                             gather, (sizeof *gather) * no_gather);
+    }
+    else
+    {
+        ml->no_segments = 0;
+        ml->segment = NULL;
     }
 }
 
 
-static int FindArg(MacroDef *def, const char *name)
+/* Expand a compiled line into out, returning its length.  If out is NULL
+   the length is just calculated.
+*/
+static size_t Expand(const MacroLine *ml, const Macro *macro, char *out)
 {
+    size_t len = 0;
     int f;
+    int a;
 
-    for(f = 0; f < def->no_args; f++)
+    for(f = 0; f < ml->no_segments; f++)
     {
-        if (CompareString(def->args[f], name))
+        const Segment *seg = ml->segment + f;
+
+        if (seg->arg == SEG_TEXT)
         {
-            return f;
+            if (out)
+            {
+                memcpy(out + len, seg->text, seg->len);
+            }
+
+            len += seg->len;
+        }
+        else if (seg->arg == SEG_ALL_ARGS)
+        {
+            for(a = 0; a < macro->argc; a++)
+            {
+                if (a > 0)
+                {
+                    if (out)
+                    {
+                        out[len] = ',';
+                    }
+
+                    len++;
+                }
+
+                len += AddArg(out ? out + len : NULL, macro, a);
+            }
+        }
+        else
+        {
+            len += AddArg(out ? out + len : NULL, macro, seg->arg);
         }
     }
 
-    return def->no_args;
+    return len;
 }
 
 /* ---------------------------------------- INTERFACES
@@ -284,26 +566,115 @@ void MacroRecord(MacroDef *macro, const char *line)
 {
     if (macro)
     {
-        macro->no_lines++;
+        MacroLine *ml;
+
+        /* The lines are gathered in memory of their own while recording, as
+           an arena can't give back what's outgrown, and moved to the arena
+           by MacroRecordEnd()
+        */
+        if (macro->no_lines == macro->lines_size)
+        {
+            macro->lines_size = macro->lines_size ? macro->lines_size * 2 : 8;
+            macro->lines = Realloc(macro->lines, macro->lines_size *
+                                                 sizeof *macro->lines);
+        }
+
+        ml = macro->lines + macro->no_lines++;
+        ml->text = ArenaDupStr(macro->arena, line);
+        ml->parsed_ok = FALSE;
+        ml->exprs = NULL;
+        ml->command = NULL;
+
+        CompileLine(macro, ml);
+
+        if (macro->repeat)
+        {
+            ml->parsed_ok = ParseLine(&ml->parsed, ml->text, macro->arena);
+
+            if (ml->parsed_ok && ml->parsed.first_column)
+            {
+                macro->scoped = TRUE;
+            }
+        }
+    }
+}
+
+
+void MacroRecordEnd(MacroDef *macro)
+{
+    if (macro && macro->lines)
+    {
+        MacroLine *lines = macro->lines;
+        size_t size = macro->no_lines * sizeof *lines;
+
+        macro->lines = memcpy(ArenaAlloc(macro->arena, size), lines, size);
+        macro->lines_size = macro->no_lines;
+        free(lines);
+    }
+}
+
+
+MacroDef *MacroCreateRepeat(const char *var, int permanent,
+                            char *err, size_t errsize)
+{
+    Arena *arena = permanent ? ArenaPermanent() : ArenaPass();
+    MacroDef *m;
+
+    if (var && (!var[0] || !CheckArgName(var)))
+    {
+        snprintf(err, errsize, "illegal argument name '%s'", var);
+        return NULL;
+    }
 
-        macro->lines = Realloc(macro->lines, macro->no_lines *
-                                                sizeof *macro->lines);
-        macro->lines[macro->no_lines - 1] = DupStr(line);
+    m = ArenaAlloc(arena, sizeof *m);
+
+    m->name = var ? "irp" : "rept";
+    m->no_args = var ? 1 : 0;
+    m->args = NULL;
+    m->no_lines = 0;
+    m->lines_size = 0;
+    m->lines = NULL;
+    m->arena = arena;
+    m->repeat = TRUE;
+    m->substitute = var != NULL;
+    m->scoped = FALSE;
+    m->next = NULL;
+
+    if (var)
+    {
+        m->args = ArenaAlloc(arena, sizeof *m->args);
+        m->args[0] = ArenaDupStr(arena, var);
     }
+
+    return m;
 }
 
+
 CommandStatus MacroFind(Macro **ret, int argc, char *argv[], int quoted[],
                         char *err, size_t errsize)
 {
     MacroDef *def = NULL;
-    Macro *macro = NULL;
-    CommandStatus status = CMD_NOT_KNOWN;
 
     if (argc > 0)
     {
         def = FindMacro(argv[0]);
     }
 
+    return MacroInvoke(ret, def, argc, argv, quoted, err, errsize);
+}
+
+MacroDef *MacroLookup(const char *name)
+{
+    return FindMacro(name);
+}
+
+CommandStatus MacroInvoke(Macro **ret, MacroDef *def,
+                          int argc, char *argv[], int quoted[],
+                          char *err, size_t errsize)
+{
+    Macro *macro = NULL;
+    CommandStatus status = CMD_NOT_KNOWN;
+
     if (def)
     {
         if (def->no_args && def->no_args != argc - 1)
@@ -318,19 +689,30 @@ CommandStatus MacroFind(Macro **ret, int argc, char *argv[], int quoted[],
         {
             int f;
 
-            macro = Malloc(sizeof *macro);
+            /* Invocations only last as long as the pass they're played in
+            */
+            macro = ArenaAlloc(ArenaPass(), sizeof *macro);
             macro->line = 0;
             macro->def = def;
             macro->argc = argc;
-            macro->argv = Malloc(argc * sizeof *macro->argv);
-            macro->quoted = Malloc(argc * sizeof *macro->quoted);
+            macro->argv = ArenaAlloc(ArenaPass(), argc * sizeof *macro->argv);
+            macro->arglen = ArenaAlloc(ArenaPass(),
+                                       argc * sizeof *macro->arglen);
+            macro->quoted = ArenaAlloc(ArenaPass(),
+                                       argc * sizeof *macro->quoted);
 
             for(f = 0; f < argc; f++)
             {
-                macro->argv[f] = DupStr(argv[f]);
+                macro->argv[f] = ArenaDupStr(ArenaPass(), argv[f]);
+                macro->arglen[f] = strlen(argv[f]);
                 macro->quoted[f] = quoted[f];
             }
 
+            macro->iteration = 1;
+            macro->count = 1;
+            macro->items = NULL;
+            macro->item_quoted = NULL;
+
             status = CMD_OK;
         }
     }
@@ -341,138 +723,174 @@ CommandStatus MacroFind(Macro **ret, int argc, char *argv[], int quoted[],
 }
 
 
-char *MacroPlay(Macro *macro)
+Macro *MacroRepeat(MacroDef *def, long count,
+                   int argc, char *argv[], int quoted[])
 {
-    if (macro && macro->line < macro->def->no_lines)
-    {
-        int size = 1000;
-        int rd;
-        char num[64];
-        char arg[128];
-        const char *line;
-        int in_num = -1;
-        int in_arg = -1;
-        Varchar *str;
+    Macro *macro;
+    int f;
 
-        line = macro->def->lines[macro->line++];
+    macro = ArenaAlloc(ArenaPass(), sizeof *macro);
+    macro->def = def;
+    macro->line = 0;
+    macro->iteration = 0;
+    macro->count = def->substitute ? argc : count;
+
+    /* The irp argument is \1, with the item for each time round swapped into
+       it
+    */
+    macro->argc = def->substitute ? 2 : 1;
+    macro->argv = ArenaAlloc(ArenaPass(), 2 * sizeof *macro->argv);
+    macro->arglen = ArenaAlloc(ArenaPass(), 2 * sizeof *macro->arglen);
+    macro->quoted = ArenaAlloc(ArenaPass(), 2 * sizeof *macro->quoted);
+    macro->argv[0] = def->name;
+    macro->arglen[0] = strlen(def->name);
+    macro->quoted[0] = 0;
+    macro->items = NULL;
+    macro->item_quoted = NULL;
+
+    if (def->substitute && argc > 0)
+    {
+        macro->items = ArenaAlloc(ArenaPass(), argc * sizeof *macro->items);
+        macro->item_quoted = ArenaAlloc(ArenaPass(),
+                                        argc * sizeof *macro->item_quoted);
 
-        /* If no arguments, simply duplicate
-        */
-        if (!strchr(line, '\\') && !strchr(line, options.arg_char))
+        for(f = 0; f < argc; f++)
         {
-            return DupStr(line);
+            macro->items[f] = ArenaDupStr(ArenaPass(), argv[f]);
+            macro->item_quoted[f] = quoted[f];
         }
+    }
 
-        /* Expand the arguments
-        */
-        str = VarcharCreate(NULL);
-        rd = 0;
+    return macro;
+}
 
-        while(line[rd])
-        {
-            if (line[rd] == '\\')
-            {
-                in_num = 0;
-                rd++;
-            }
-            else if (line[rd] == options.arg_char)
-            {
-                in_arg = 0;
-                rd++;
-            }
-            else
-            {
-                if (in_num != -1)
-                {
-                    if (isdigit((unsigned char)line[rd]) && in_num < 60)
-                    {
-                        num[in_num++] = line[rd++];
-                    }
-                    else
-                    {
-                        if (in_num == 0 && line[rd] == '*')
-                        {
-                            int f;
-
-                            rd++;
-
-                            for(f = 0; f < macro->argc; f++)
-                            {
-                                if (f > 0)
-                                {
-                                    VarcharAddChar(str, ',');
-                                }
-
-                                AddArg(str, macro, f);
-                            }
-                            in_num = -1;
-                        }
-                        else
-                        {
-                            num[in_num] = 0;
-                            AddArg(str, macro, atoi(num));
-                            in_num = -1;
-                        }
-                    }
-                }
-                else if (in_arg != -1)
-                {
-                    if (strchr(arg_chars, line[rd]) && in_arg < 125)
-                    {
-                        arg[in_arg++] = line[rd++];
-                    }
-                    else
-                    {
-                        arg[in_arg] = 0;
-                        AddArg(str, macro, FindArg(macro->def, arg) + 1);
-                        in_arg = -1;
-                    }
-                }
-                else
-                {
-                    VarcharAddChar(str, line[rd++]);
-                }
-            }
-        }
 
-        /* Check for arguments at the end of the line
-        */
-        if (in_num != -1)
+int MacroNextIteration(Macro *macro)
+{
+    if (!macro->def->repeat || !macro->def->no_lines ||
+                                    macro->iteration >= macro->count)
+    {
+        return FALSE;
+    }
+
+    if (macro->items)
+    {
+        macro->argv[1] = macro->items[macro->iteration];
+        macro->arglen[1] = strlen(macro->argv[1]);
+        macro->quoted[1] = macro->item_quoted[macro->iteration];
+    }
+
+    macro->iteration++;
+    macro->line = 0;
+
+    return TRUE;
+}
+
+
+int MacroIsRepeat(Macro *macro)
+{
+    return macro->def->repeat;
+}
+
+
+int MacroScoped(Macro *macro)
+{
+    return macro->def->scoped;
+}
+
+
+/* The line last played, if its tokens and caches can be reused
+*/
+static MacroLine *ReusableLine(Macro *macro)
+{
+    MacroLine *ml;
+
+    if (!macro->def->repeat || macro->line == 0)
+    {
+        return NULL;
+    }
+
+    ml = macro->def->lines + macro->line - 1;
+
+    return ml->parsed_ok && !ml->no_segments ? ml : NULL;
+}
+
+
+const Line *MacroParsedLine(Macro *macro)
+{
+    MacroLine *ml = ReusableLine(macro);
+
+    return ml ? &ml->parsed : NULL;
+}
+
+
+CompiledExpr **MacroExprCache(Macro *macro)
+{
+    MacroLine *ml = ReusableLine(macro);
+
+    return ml && macro->def->arena == ArenaPermanent() ? &ml->exprs : NULL;
+}
+
+
+void **MacroCommandCache(Macro *macro)
+{
+    MacroLine *ml = ReusableLine(macro);
+
+    return ml && macro->def->arena == ArenaPermanent() ? &ml->command : NULL;
+}
+
+
+static const char *Play(Macro *macro)
+{
+    if (macro && macro->line < macro->def->no_lines)
+    {
+        MacroLine *ml = macro->def->lines + macro->line++;
+        size_t len;
+        char *line;
+
+        if (ml->arg_char != options.arg_char)
         {
-            num[in_num] = 0;
-            AddArg(str, macro, atoi(num));
-            in_num = -1;
+            CompileLine(macro->def, ml);
         }
 
-        if (in_arg != -1)
+        if (!ml->no_segments)
         {
-            arg[in_arg] = 0;
-            AddArg(str, macro, FindArg(macro->def, arg) + 1);
-            in_arg = -1;
+            return ml->text;
         }
 
-        return VarcharTransfer(str);
+        /* Size the line, then expand it into the line arena
+        */
+        len = Expand(ml, macro, NULL);
+        line = ArenaAlloc(ArenaLine(), len + 1);
+        Expand(ml, macro, line);
+        line[len] = 0;
+
+        return line;
     }
 
     return NULL;
 }
 
 
-void MacroFree(Macro *macro)
+const char *MacroPlay(Macro *macro)
 {
-    if (macro)
-    {
-        int f;
+    static StatsCounter stats = STATS_COUNTER("MacroPlay");
+    double start = 0;
+    const char *line;
 
-        for(f = 0; f < macro->argc; f++)
-        {
-            free(macro->argv[f]);
-        }
+    STATS_START(start);
+    line = Play(macro);
+    STATS_END(stats, start);
 
-        free(macro->quoted);
-        free(macro->argv);
-        free(macro);
-    }
+    return line;
+}
+
+
+void MacroFree(Macro *macro)
+{
+    /* Invocations are allocated from the pass arena, which is released as
+       a whole at the end of the pass
+    */
 }
 
 
@@ -509,7 +927,7 @@ void MacroDump(FILE *fp)
 
         for(f = 0; f < m->no_lines; f++)
         {
-            fprintf(fp, "; %s\n", m->lines[f]);
+            fprintf(fp, "; %s\n", m->lines[f].text);
         }
 
         fprintf(fp, "; ENDM\n");
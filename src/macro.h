@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include "cmd.h"
 #include "parse.h"
+#include "expr.h"
 
 typedef struct mdef MacroDef;
 typedef struct macro Macro;
@@ -56,11 +57,29 @@ MacroDef        *MacroCreate(const char *name, int argc, char *argv[],
                              char *err, size_t errsize);
 
 
-/* Record a macro's contents. 
+/* Record a line of a macro.  The line is compiled into a template of text
+   and argument references, so playing it back needs no searching.
 */
 void            MacroRecord(MacroDef *macro, const char *line);
 
 
+/* Finish recording a macro, at its endm or endr.  It can't be played until
+   this is called.
+*/
+void            MacroRecordEnd(MacroDef *macro);
+
+
+/* Create a block to be repeated, as started by rept or irp.  var is the name
+   of the argument irp sets to each item, or NULL for rept.  Lines are added
+   with MacroRecord().  A permanent block is kept for the whole run, so can be
+   recorded once and played on every pass, otherwise it only lasts until the
+   end of the pass.  Returns NULL and updates the error string if var isn't a
+   valid name.
+*/
+MacroDef        *MacroCreateRepeat(const char *var, int permanent,
+                                   char *err, size_t errsize);
+
+
 /* Find a macro, placing a pointer to it in the passed macro or NULL if not
    known, or an error occurred.  Records the passed arguments for playing back
    the macro.  argv[0] is the macro name.
@@ -73,14 +92,69 @@ CommandStatus   MacroFind(Macro **macro, int argc, char *argv[], int quoted[],
                           char *err, size_t errsize);
 
 
+/* Find a macro definition by name.  Returns NULL if it is not known.
+*/
+MacroDef        *MacroLookup(const char *name);
+
+
+/* As MacroFind(), but for an already found definition.  def can be NULL, in
+   which case CMD_NOT_KNOWN is returned.
+*/
+CommandStatus   MacroInvoke(Macro **macro, MacroDef *def,
+                            int argc, char *argv[], int quoted[],
+                            char *err, size_t errsize);
+
+
+/* Set up playing a repeated block.  For rept the block is played count
+   times.  For irp it's played once for each of the argc items in argv, with
+   the argument set to each in turn.  MacroNextIteration() must be called to
+   start the first time round.
+*/
+Macro           *MacroRepeat(MacroDef *def, long count,
+                             int argc, char *argv[], int quoted[]);
+
+
+/* Start the next time round a repeated block, after MacroPlay() has returned
+   NULL.  Returns FALSE if it has been played enough times, and always for a
+   macro.
+*/
+int             MacroNextIteration(Macro *macro);
+
+
+/* Returns TRUE if the macro is a repeated block rather than a macro.
+*/
+int             MacroIsRepeat(Macro *macro);
+
+
+/* Returns TRUE if each playing of the macro needs its own label scope.
+   Macros always do, repeated blocks only if they define labels.
+*/
+int             MacroScoped(Macro *macro);
+
+
+/* Get the tokenised form of the line last played, if it was kept when the
+   line was recorded.  Returns NULL if the line has to be parsed.
+*/
+const Line      *MacroParsedLine(Macro *macro);
+
+
+/* As SourceExprCache() and SourceCommandCache(), for the line last played.
+   Returns NULL unless the line can keep them, which is only when
+   MacroParsedLine() returns the line and the block is permanent.
+*/
+CompiledExpr    **MacroExprCache(Macro *macro);
+void            **MacroCommandCache(Macro *macro);
+
+
 /* Playback a found macro.  Returns the next line, or NULL if the macro has
-   finished.  The returned line is argument expanded and must be free()ed
-   after use.
+   finished.  The returned line is argument expanded and lasts until the line
+   arena is next reset.
 */
-char            *MacroPlay(Macro *macro);
+const char      *MacroPlay(Macro *macro);
 
 
-/* Free a macro once it's finished playing.
+/* Free a macro once it's finished playing.  Invocations live in the pass
+   arena, so this releases nothing itself.
 */
 void            MacroFree(Macro *macro);
 
@@ -24,17 +24,25 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "global.h"
 #include "memory.h"
 #include "expr.h"
 #include "util.h"
+#include "stats.h"
 
 
 /* ---------------------------------------- TYPES AND GLOBALS
 */
 #define PAGE_SIZE       1024
 
+/* Pages are found through a two level directory, indexed by the page number.
+   The top level grows as needed, and each entry covers DIR_SIZE pages.
+*/
+#define DIR_BITS        11
+#define DIR_SIZE        (1ul << DIR_BITS)
+
 typedef struct
 {
     ulong       base_address;
@@ -45,7 +53,9 @@ typedef struct
 {
     unsigned    number;
     int         no_pages;
-    Page        **page;
+    Page        ***dir;
+    ulong       dir_size;
+    Page        *last_page;
     ulong       min_address_used;
     ulong       max_address_used;
     int         used;
@@ -60,6 +70,17 @@ static WordMode wmode = LSB_Word;
 static Bank             **banks;
 static unsigned         *defined_banks;
 
+/* Banks are also held in a hash table keyed on the bank number, with the
+   last bank found checked first.
+*/
+static Bank             **bank_index;
+static int              bank_index_size;
+static Bank             *last_bank;
+
+/* Pages in all banks
+*/
+static long             no_pages;
+
 /* ---------------------------------------- PRIVATE
 */
 static int SortBankNumbers(const void *pa, const void *pb)
@@ -79,16 +100,63 @@ static int SortBankNumbers(const void *pa, const void *pb)
     return 0;
 }
 
-static Bank *FindBank(unsigned n)
+static unsigned BankSlot(unsigned n)
+{
+    return (n * 2654435761u) & (bank_index_size - 1);
+}
+
+static void IndexBanks(void)
 {
     int f;
 
+    free(bank_index);
+
+    bank_index_size = bank_index_size ? bank_index_size * 2 : 16;
+    bank_index = Malloc((sizeof *bank_index) * bank_index_size);
+
+    for(f = 0; f < bank_index_size; f++)
+    {
+        bank_index[f] = NULL;
+    }
+
     for(f = 0; f < num_banks; f++)
     {
-        if (banks[f]->number == n)
+        unsigned i = BankSlot(banks[f]->number);
+
+        while(bank_index[i])
         {
-            return banks[f];
+            i = (i + 1) & (bank_index_size - 1);
         }
+
+        bank_index[i] = banks[f];
+    }
+}
+
+static Bank *FindBank(unsigned n)
+{
+    unsigned i;
+
+    if (last_bank && last_bank->number == n)
+    {
+        return last_bank;
+    }
+
+    if (!bank_index)
+    {
+        return NULL;
+    }
+
+    i = BankSlot(n);
+
+    while(bank_index[i])
+    {
+        if (bank_index[i]->number == n)
+        {
+            last_bank = bank_index[i];
+            return last_bank;
+        }
+
+        i = (i + 1) & (bank_index_size - 1);
     }
 
     return NULL;
@@ -102,7 +170,9 @@ static Bank *AddBank(unsigned n)
     banks[num_banks-1] = Malloc(sizeof **banks);
     banks[num_banks-1]->number = n;
     banks[num_banks-1]->no_pages = 0;
-    banks[num_banks-1]->page = NULL;
+    banks[num_banks-1]->dir = NULL;
+    banks[num_banks-1]->dir_size = 0;
+    banks[num_banks-1]->last_page = NULL;
     banks[num_banks-1]->min_address_used = address_space;
     banks[num_banks-1]->max_address_used = 0;
     banks[num_banks-1]->used = FALSE;
@@ -111,6 +181,24 @@ static Bank *AddBank(unsigned n)
     defined_banks[num_banks - 1] = n;
     qsort(defined_banks, num_banks, sizeof *defined_banks, SortBankNumbers);
 
+    /* Rebuilding the index also adds the new bank
+    */
+    if (num_banks * 2 > bank_index_size)
+    {
+        IndexBanks();
+    }
+    else
+    {
+        unsigned i = BankSlot(n);
+
+        while(bank_index[i])
+        {
+            i = (i + 1) & (bank_index_size - 1);
+        }
+
+        bank_index[i] = banks[num_banks - 1];
+    }
+
     return FindBank(n);
 }
 
@@ -128,23 +216,42 @@ static Bank *GetOrAddBank(unsigned n)
 
 static Page *FindPage(Bank *bank, ulong address)
 {
-     int f;
+    ulong n;
+    ulong top;
+    Page *p;
 
-     for(f = 0; f < bank->no_pages; f++)
-     {
-        if (address >= bank->page[f]->base_address &&
-                address < bank->page[f]->base_address + PAGE_SIZE)
-        {
-            return bank->page[f];
-        }
-     }
+    /* Check the last page used first, as access is mostly sequential
+    */
+    p = bank->last_page;
+
+    if (p && address - p->base_address < PAGE_SIZE)
+    {
+        return p;
+    }
+
+    n = address / PAGE_SIZE;
+    top = n >> DIR_BITS;
+
+    if (top >= bank->dir_size || !bank->dir[top])
+    {
+        return NULL;
+    }
+
+    p = bank->dir[top][n & (DIR_SIZE - 1)];
+
+    if (p)
+    {
+        bank->last_page = p;
+    }
 
-     return NULL;
+    return p;
 }
 
 static Page *GetOrAddPage(Bank *bank, ulong address)
 {
-    int f;
+    ulong n;
+    ulong top;
+    ulong f;
     Page *p = FindPage(bank, address);
 
     if (p)
@@ -152,21 +259,128 @@ static Page *GetOrAddPage(Bank *bank, ulong address)
         return p;
     }
 
-    p = Malloc(sizeof *p);
-    p->base_address = (address / PAGE_SIZE) * PAGE_SIZE;
+    n = address / PAGE_SIZE;
+    top = n >> DIR_BITS;
 
-    for(f = 0; f < PAGE_SIZE; f++)
+    if (top >= bank->dir_size)
     {
-        p->memory[f] = 0;
+        bank->dir = Realloc(bank->dir, (sizeof *bank->dir) * (top + 1));
+
+        for(f = bank->dir_size; f <= top; f++)
+        {
+            bank->dir[f] = NULL;
+        }
+
+        bank->dir_size = top + 1;
+    }
+
+    if (!bank->dir[top])
+    {
+        bank->dir[top] = Malloc((sizeof **bank->dir) * DIR_SIZE);
+
+        for(f = 0; f < DIR_SIZE; f++)
+        {
+            bank->dir[top][f] = NULL;
+        }
     }
 
+    p = Malloc(sizeof *p);
+    p->base_address = n * PAGE_SIZE;
+    memset(p->memory, 0, PAGE_SIZE);
+
+    bank->dir[top][n & (DIR_SIZE - 1)] = p;
     bank->no_pages++;
-    bank->page = Realloc(bank->page, sizeof *bank->page * bank->no_pages);
-    bank->page[bank->no_pages - 1] = p;
+    bank->last_page = p;
+
+    no_pages++;
+    STATS_PEAK("pages", no_pages);
 
     return p;
 }
 
+/* Copy or fill a run of bytes a page at a time.  If data is NULL the run is
+   filled with value.  The write markers are updated once for the whole run.
+*/
+static void WriteRun(unsigned bank, ulong addr,
+                     const Byte *data, Byte value, ulong len)
+{
+    Bank *b;
+    ulong a = addr;
+    ulong left = len;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    b = GetOrAddBank(bank);
+
+    while(left > 0)
+    {
+        Page *p = GetOrAddPage(b, a);
+        ulong offset = a - p->base_address;
+        ulong n = PAGE_SIZE - offset;
+
+        if (n > left)
+        {
+            n = left;
+        }
+
+        if (data)
+        {
+            memcpy(p->memory + offset, data, n);
+            data += n;
+        }
+        else
+        {
+            memset(p->memory + offset, value, n);
+        }
+
+        a += n;
+        left -= n;
+    }
+
+    b->used = TRUE;
+
+    if (addr < b->min_address_used)
+    {
+        b->min_address_used = addr;
+    }
+
+    if (addr + len - 1 > b->max_address_used)
+    {
+        b->max_address_used = addr + len - 1;
+    }
+}
+
+
+/* Write a run at the PC, wrapping around the address space as PCWrite()
+   would.
+*/
+static void PCWriteRun(const Byte *data, Byte value, ulong len)
+{
+    while(len > 0)
+    {
+        ulong n = address_space - pc;
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        WriteRun(currbank, pc, data, value, n);
+
+        if (data)
+        {
+            data += n;
+        }
+
+        len -= n;
+        pc = (pc + n) % address_space;
+    }
+}
+
+
 /* ---------------------------------------- INTERFACES
 */
 
@@ -263,6 +477,18 @@ void PCWrite(int i)
 }
 
 
+void PCWriteBlock(const Byte *data, ulong len)
+{
+    PCWriteRun(data, 0, len);
+}
+
+
+void PCFill(int i, ulong len)
+{
+    PCWriteRun(NULL, ExprConvert(8, i), len);
+}
+
+
 void PCWriteWord(int i)
 {
     PCWriteWordMode(i, wmode);
@@ -327,8 +553,14 @@ void MemoryWrite(ulong addr, Byte value)
 
 void MemoryWriteBank(unsigned bank, ulong addr, Byte value)
 {
-    Bank *b = GetOrAddBank(bank);
-    Page *p = GetOrAddPage(b, addr);
+    static StatsCounter stats = STATS_COUNTER("MemoryWriteBank");
+    Bank *b;
+    Page *p;
+
+    STATS_COUNT(stats);
+
+    b = GetOrAddBank(bank);
+    p = GetOrAddPage(b, addr);
 
     p->memory[addr - p->base_address] = value;
 
@@ -345,18 +577,74 @@ void MemoryWriteBank(unsigned bank, ulong addr, Byte value)
     }
 }
 
+void MemoryWriteBlock(unsigned bank, ulong addr, const Byte *data, ulong len)
+{
+    WriteRun(bank, addr, data, 0, len);
+}
+
+void MemoryFillBlock(unsigned bank, ulong addr, Byte value, ulong len)
+{
+    WriteRun(bank, addr, NULL, value, len);
+}
+
 Byte *MemoryGetBlock(unsigned bank, ulong addr, ulong length)
 {
     Byte *mem = Malloc(length);
+    ulong i = 0;
 
-    for(ulong i = 0 ; i < length; i++)
+    while(i < length)
     {
-        mem[i] = MemoryReadBank(bank, addr + i);
+        ulong run;
+        const Byte *p = MemoryView(bank, addr + i, length - i, &run);
+
+        memcpy(mem + i, p, run);
+        i += run;
     }
 
     return mem;
 }
 
+const Byte *MemoryView(unsigned bank, ulong addr, ulong length, ulong *run)
+{
+    static const Byte empty[PAGE_SIZE];
+    Bank *b = GetOrAddBank(bank);
+    Page *p = FindPage(b, addr);
+    ulong offset = addr % PAGE_SIZE;
+
+    *run = PAGE_SIZE - offset;
+
+    if (*run > length)
+    {
+        *run = length;
+    }
+
+    if (p)
+    {
+        return p->memory + offset;
+    }
+
+    return empty + offset;
+}
+
+int MemoryWriteFile(FILE *fp, unsigned bank, ulong addr, ulong length)
+{
+    while(length > 0)
+    {
+        ulong run;
+        const Byte *p = MemoryView(bank, addr, length, &run);
+
+        if (fwrite(p, 1, run, fp) != run)
+        {
+            return FALSE;
+        }
+
+        addr += run;
+        length -= run;
+    }
+
+    return TRUE;
+}
+
 /*
 vim: ai sw=4 ts=8 expandtab
 */
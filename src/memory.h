@@ -27,6 +27,8 @@
 #ifndef CASM_MEMORY_H
 #define CASM_MEMORY_H
 
+#include <stdio.h>
+
 #include "global.h"
 
 /* ---------------------------------------- TYPES
@@ -103,6 +105,17 @@ void    PCAdd(int i);
 void    PCWrite(int i);
 
 
+/* Write a block of bytes to the PC and move it past them.  This is the same
+   as calling PCWrite() for each byte, but works a page at a time.
+*/
+void    PCWriteBlock(const Byte *data, ulong len);
+
+
+/* Write the same byte len times to the PC and move it past them.
+*/
+void    PCFill(int i, ulong len);
+
+
 /* Write a word to the PC and increment it
 */
 void    PCWriteWord(int i);
@@ -133,10 +146,32 @@ void    MemoryWrite(ulong addr, Byte value);
 */
 void    MemoryWriteBank(unsigned bank, ulong addr, Byte value);
 
+/* Write a block of bytes to the passed bank.  The same as calling
+   MemoryWriteBank() for each byte, but copies a page at a time.
+*/
+void    MemoryWriteBlock(unsigned bank, ulong addr, const Byte *data, ulong len);
+
+/* Fill a block of the passed bank with a value.
+*/
+void    MemoryFillBlock(unsigned bank, ulong addr, Byte value, ulong len);
+
 /* Get a flat array of memory.  The return must be freed.
 */
 Byte    *MemoryGetBlock(unsigned bank, ulong addr, ulong length);
 
+/* Get a view straight into the memory of the passed bank.  Returns a pointer
+   to the bytes at addr, and sets run to how many of the next length bytes
+   can be read from it, which stops at the end of a page.  Memory that has
+   never been written reads as zero.  The view must not be written to, and is
+   only valid until memory is next written.
+*/
+const Byte *MemoryView(unsigned bank, ulong addr, ulong length, ulong *run);
+
+/* Write a block of memory from the passed bank to a file, a page at a time.
+   Returns FALSE if the file could not be written.
+*/
+int     MemoryWriteFile(FILE *fp, unsigned bank, ulong addr, ulong length);
+
 
 #endif
 
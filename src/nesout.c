@@ -41,6 +41,13 @@
 /* ---------------------------------------- MACROS & TYPES
 */
 
+/* The CPU vectors are set up in a buffer and then written into bank memory.
+   VEC() converts a vector address into an offset in that buffer.
+*/
+#define VECTOR_ADDR     0xfffa
+#define VECTOR_SIZE     6
+#define VEC(a)          ((a) - VECTOR_ADDR)
+
 enum option_t
 {
     OPT_VECTOR,
@@ -320,12 +327,12 @@ int NESOutput(const char *filename, const char *filename_bank,
     {
         if (GetLowWriteMarker(banks[f]) > 0x2000)
         {
-            Byte *mem;
-
-            mem = MemoryGetBlock(banks[f], 0, 0x10000);
-
             if (f == first_code)
             {
+                Byte *mem;
+
+                mem = MemoryGetBlock(banks[f], VECTOR_ADDR, VECTOR_SIZE);
+
                 /* Setup vectors
                 */
                 start = option.vector[VECTOR_RESET];
@@ -339,11 +346,11 @@ int NESOutput(const char *filename, const char *filename_bank,
                                                     start);
                 }
 
-                PokeW(mem, 0xfffc, start);
+                PokeW(mem, VEC(0xfffc), start);
 
                 if (option.vector[VECTOR_NMI] != -1)
                 {
-                    PokeW(mem, 0xfffa, option.vector[VECTOR_NMI]);
+                    PokeW(mem, VEC(0xfffa), option.vector[VECTOR_NMI]);
                 }
                 else
                 {
@@ -352,20 +359,22 @@ int NESOutput(const char *filename, const char *filename_bank,
 
                 if (option.vector[VECTOR_BRK] != -1)
                 {
-                    PokeW(mem, 0xfffe, option.vector[VECTOR_BRK]);
+                    PokeW(mem, VEC(0xfffe), option.vector[VECTOR_BRK]);
                 }
+
+                MemoryWriteBlock(banks[f], VECTOR_ADDR, mem, VECTOR_SIZE);
+
+                free(mem);
             }
 
             if (is_16k)
             {
-                fwrite(mem + 0xc000, 0x4000, 1, fp);
+                MemoryWriteFile(fp, banks[f], 0xc000, 0x4000);
             }
             else
             {
-                fwrite(mem + 0x8000, 0x8000, 1, fp);
+                MemoryWriteFile(fp, banks[f], 0x8000, 0x8000);
             }
-
-            free(mem);
         }
     }
 
@@ -375,13 +384,7 @@ int NESOutput(const char *filename, const char *filename_bank,
     {
         if (GetLowWriteMarker(banks[f]) < 0x2000)
         {
-            Byte *mem;
-
-            mem = MemoryGetBlock(banks[f], 0, 0x2000);
-
-            fwrite(mem, 0x2000, 1, fp);
-
-            free(mem);
+            MemoryWriteFile(fp, banks[f], 0, 0x2000);
         }
     }
 
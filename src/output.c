@@ -24,9 +24,11 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "global.h"
 #include "output.h"
+#include "stats.h"
 
 /* ---------------------------------------- GLOBALS
 */
@@ -124,19 +126,10 @@ CommandStatus OutputSetOption(int opt, int argc, char *argv[],
 }
 
 
-int OutputCode(void)
+/* Run the writer for the current format
+*/
+static int Write(const unsigned *banks, int count)
 {
-    int count;
-    const unsigned *banks;
-
-    banks = DefinedBanks(&count);
-
-    if (!banks || count == 0)
-    {
-        fprintf(stderr, "Skipping output; no written memory to write\n");
-        return TRUE;
-    }
-
     switch(format)
     {
         case RAW:
@@ -191,12 +184,75 @@ int OutputCode(void)
 }
 
 
+int OutputCode(void)
+{
+    /* Indexed by Format
+    */
+    static StatsCounter stats[] =
+    {
+        STATS_COUNTER("output raw"),
+        STATS_COUNTER("output spectrum"),
+        STATS_COUNTER("output t64"),
+        STATS_COUNTER("output zx81"),
+        STATS_COUNTER("output gameboy"),
+        STATS_COUNTER("output snes"),
+        STATS_COUNTER("output lib"),
+        STATS_COUNTER("output nes"),
+        STATS_COUNTER("output cpc"),
+        STATS_COUNTER("output prg"),
+        STATS_COUNTER("output hex"),
+        STATS_COUNTER("output cbm-tap")
+    };
+
+    int count;
+    const unsigned *banks;
+    double start = 0;
+    int ok;
+
+    banks = DefinedBanks(&count);
+
+    if (!banks || count == 0)
+    {
+        fprintf(stderr, "Skipping output; no written memory to write\n");
+        return TRUE;
+    }
+
+    STATS_START(start);
+    ok = Write(banks, count);
+    STATS_END(stats[format], start);
+
+    return ok;
+}
+
+
 const char *OutputError(void)
 {
     return error;
 }
 
 
+void OutputNameFrom(const char *source)
+{
+    size_t len = 0;
+
+    snprintf(output, sizeof output, "%s.output", source);
+
+    /* The bank name is a format, so any % in the path is doubled
+    */
+    while(*source && len < sizeof output_bank - 16)
+    {
+        if (*source == '%')
+        {
+            output_bank[len++] = '%';
+        }
+
+        output_bank[len++] = *source++;
+    }
+
+    strcpy(output_bank + len, ".output.%u");
+}
+
+
 /*
 vim: ai sw=4 ts=8 expandtab
 */
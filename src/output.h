@@ -65,6 +65,13 @@ int     OutputCode(void);
 const char *OutputError(void);
 
 
+/* Name the default output files after a source file, as file.output and
+   file.output.<bank>, rather than output and output.<bank>.  An output-file
+   or output-bank option in the source still takes precedence.
+*/
+void    OutputNameFrom(const char *source);
+
+
 #endif
 
 /*
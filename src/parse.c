@@ -30,6 +30,7 @@
 #include "global.h"
 #include "codepage.h"
 #include "parse.h"
+#include "stats.h"
 
 /* ---------------------------------------- MACROS/TYPES
 */
@@ -43,7 +44,7 @@ typedef enum
 
 /* ---------------------------------------- GLOBALS
 */
-static char     error[1024];
+static CASM_THREAD_LOCAL char  error[1024];
 
 static const ValueTable bool_table[] =
 {
@@ -53,11 +54,26 @@ static const ValueTable bool_table[] =
 
 
 
+/* Tokens are gathered here and copied to the line once it's been parsed, so
+   the line's arrays are only allocated once.  Each thread has its own, as
+   sources are loaded in parallel.
+*/
+static CASM_THREAD_LOCAL char   **tokens;
+static CASM_THREAD_LOCAL int    *quotes;
+static CASM_THREAD_LOCAL int    tokens_size;
+
+
 /* ---------------------------------------- PRIVATE FUNCTIONS
 */
+static void *Alloc(Arena *arena, size_t len)
+{
+    return arena ? ArenaAlloc(arena, len) : Malloc(len);
+}
+
+
 static void AddToken(const char *start, const char *end, Line *line, int quoted)
 {
-    char *tok = Malloc(end - start + 2);
+    char *tok = Alloc(line->arena, end - start + 2);
     char *p;
 
     p = tok;
@@ -71,29 +87,25 @@ static void AddToken(const char *start, const char *end, Line *line, int quoted)
 
     Trim(tok);
 
-    /* Special case to convert single characters in quotes to their character
-       code.
+    /* Single characters in quotes are replaced by their character code.
+       That depends on the codepage when the line is run rather than when it
+       was parsed, so here they're just marked.
     */
     if (*tok && *(tok+1) == 0 && (quoted == '\'' || quoted == '"'))
     {
-        char b[64];
-
-        snprintf(b, sizeof b, "%d", CodepageConvert(*tok));
-        free(tok);
+        quoted = QUOTED_CHAR;
+    }
 
-        tok = DupStr(b);
-        quoted = 0;
+    if (line->no_tokens == tokens_size)
+    {
+        tokens_size = tokens_size ? tokens_size * 2 : 64;
+        tokens = Realloc(tokens, (sizeof *tokens) * tokens_size);
+        quotes = Realloc(quotes, (sizeof *quotes) * tokens_size);
     }
 
+    tokens[line->no_tokens] = tok;
+    quotes[line->no_tokens] = quoted;
     line->no_tokens++;
-
-    line->token = Realloc(line->token, (sizeof *line->token) * line->no_tokens);
-
-    line->quoted = Realloc(line->quoted,
-                            (sizeof *line->quoted) * line->no_tokens);
-
-    line->token[line->no_tokens - 1] = tok;
-    line->quoted[line->no_tokens - 1] = quoted;
 }
 
 
@@ -111,7 +123,7 @@ static int IsClosure(const char *p, const char *sep)
 /* ---------------------------------------- INTERFACES
 */
 
-int ParseLine(Line *line, const char *source)
+int ParseLine(Line *line, const char *source, Arena *arena)
 {
     static const char *sep_chars[2] =
     {
@@ -131,6 +143,8 @@ int ParseLine(Line *line, const char *source)
         "\"')]"
     };
 
+    static StatsCounter stats = STATS_COUNTER("ParseLine");
+
     const char *p = NULL;
     const char *start = NULL;
     State state = CONSUME_WS;
@@ -138,6 +152,9 @@ int ParseLine(Line *line, const char *source)
     char open_quote = 0;
     char quote = 0;
     int status = TRUE;
+    double stats_start = 0;
+
+    STATS_START(stats_start);
 
     p = source;
 
@@ -146,6 +163,7 @@ int ParseLine(Line *line, const char *source)
     line->comment = NULL;
     line->quoted = NULL;
     line->no_tokens = 0;
+    line->arena = arena;
 
     while(state != FINISHED)
     {
@@ -159,7 +177,7 @@ int ParseLine(Line *line, const char *source)
                 else if (*p == ';')
                 {
                     state = FINISHED;
-                    line->comment = DupStr(p + 1);
+                    line->comment = strcpy(Alloc(arena, strlen(p)), p + 1);
                     Trim(line->comment);
                 }
                 else
@@ -276,6 +294,17 @@ int ParseLine(Line *line, const char *source)
         }
     }
 
+    if (line->no_tokens)
+    {
+        line->token = Alloc(arena, (sizeof *line->token) * line->no_tokens);
+        line->quoted = Alloc(arena, (sizeof *line->quoted) * line->no_tokens);
+
+        memcpy(line->token, tokens, (sizeof *line->token) * line->no_tokens);
+        memcpy(line->quoted, quotes, (sizeof *line->quoted) * line->no_tokens);
+    }
+
+    STATS_END(stats, stats_start);
+
     return status;
 }
 
@@ -284,6 +313,14 @@ void ParseFree(Line *line)
 {
     int f;
 
+    if (line->arena)
+    {
+        line->token = NULL;
+        line->quoted = NULL;
+        line->comment = NULL;
+        return;
+    }
+
     if (line->token)
     {
         for(f = 0; f < line->no_tokens; f++)
@@ -306,11 +343,32 @@ void ParseFree(Line *line)
 }
 
 
+void ParseFreeThread(void)
+{
+    free(tokens);
+    free(quotes);
+
+    tokens = NULL;
+    quotes = NULL;
+    tokens_size = 0;
+}
+
+
 const char *ParseError(void)
 {
     return error;
 }
 
+char *ParseCharCode(const char *token, Arena *arena)
+{
+    char b[64];
+
+    snprintf(b, sizeof b, "%d", CodepageConvert(*token));
+
+    return ArenaDupStr(arena, b);
+}
+
+
 const ValueTable *ParseTable(const char *str, const ValueTable *table)
 {
     while(table && table->str)
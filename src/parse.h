@@ -26,6 +26,8 @@
 #ifndef CASM_PARSE_H
 #define CASM_PARSE_H
 
+#include "arena.h"
+
 /* ---------------------------------------- TYPES
 */
 
@@ -35,9 +37,13 @@
 
    If quoted[i] is non-zero it contains the opening character that was used to
    quote argument [i].  Note that '(' counts as a quote in command arguments.
+   A single character in quotes is instead marked with QUOTED_CHAR, and should
+   be replaced with ParseCharCode() before the line is run.
 
    If first_column is true then the first column held a parsable character.
 
+   If arena is set the dynamic parts were allocated from it.
+
 */
 typedef struct Line
 {
@@ -46,6 +52,7 @@ typedef struct Line
     int         *quoted;
     char        **token;
     char        *comment;
+    Arena       *arena;
 } Line;
 
 
@@ -62,6 +69,10 @@ typedef struct ValueTable
 /* ---------------------------------------- MACROS
 */
 
+/* The quoted[] value for a single character in quotes
+*/
+#define QUOTED_CHAR     1
+
 
 /* Defines the set of values allowed for boolean strings and generates table
    entries using the passed 'tv' and 'fv' for true and false respictively.
@@ -78,23 +89,37 @@ typedef struct ValueTable
 */
 
 /* Parses a line.  Returns TRUE if line parsed OK, otherwise returns FALSE.
-   ParseError() will return the reason for any failures.
+   ParseError() will return the reason for any failures.  The tokens are
+   allocated from arena, or with Malloc() if it is NULL.
 
    Remember that it may be possible to get a line with no tokens.
 */
-int             ParseLine(Line *line, const char *source);
+int             ParseLine(Line *line, const char *source, Arena *arena);
 
 
-/* Free up the dynamic parts of a tokenised line
+/* Free up the dynamic parts of a tokenised line.  Does nothing for a line
+   parsed into an arena.
 */
 void            ParseFree(Line *line);
 
 
+/* Free the calling thread's working buffers.  Threads that parse lines must
+   call this before they exit.
+*/
+void            ParseFreeThread(void);
+
+
 /* Returns a reason for the last failure.
 */
 const char      *ParseError(void);
 
 
+/* Get the character code for a token marked QUOTED_CHAR in the current
+   codepage, as a string allocated from arena.
+*/
+char            *ParseCharCode(const char *token, Arena *arena);
+
+
 /* Return a value from a table.  The check is done case insensitive.  Returns
    the value item, or NULL if not found.
 */
@@ -162,7 +162,7 @@ int PRGOutput(const char *filename, const char *filename_bank,
         FILE *fp;
         char buff[4096];
         const char *name;
-        Byte *mem;
+        Byte basic[32];
         int min, max, len;
         char sys[16];
         int addr;
@@ -201,7 +201,6 @@ int PRGOutput(const char *filename, const char *filename_bank,
                 break;
         }
 
-        mem = MemoryGetBlock(banks[f], 0, 0x10000);
         min = GetLowWriteMarker(banks[f]);
         max = GetHighWriteMarker(banks[f]);
 
@@ -224,16 +223,21 @@ int PRGOutput(const char *filename, const char *filename_bank,
             snprintf(sys, sizeof sys, "%d", options.start_addr);
         }
 
-        addr = PokeW(mem, addr, 10);
-        addr = PokeB(mem, addr, 0x9e);
-        addr = PokeS(mem, addr, sys);
-        addr = PokeB(mem, addr, 0x00);
+        /* The BASIC is built in a buffer holding the memory from start_addr,
+           and then written into the bank.
+        */
+        addr = PokeW(basic, addr - start_addr, 10);
+        addr = PokeB(basic, addr, 0x9e);
+        addr = PokeS(basic, addr, sys);
+        addr = PokeB(basic, addr, 0x00);
+
+        next = start_addr + addr;
 
-        next = addr;
+        addr = PokeW(basic, addr, 0x00);
 
-        addr = PokeW(mem, addr, 0x00);
+        PokeW(basic, 0, next);
 
-        PokeW(mem, start_addr, next);
+        MemoryWriteBlock(banks[f], start_addr, basic, addr);
 
         min = start_addr;        /* Start of BASIC */
 
@@ -242,11 +246,9 @@ int PRGOutput(const char *filename, const char *filename_bank,
         /* Output PRG file
         */
         WriteWord(fp, min);
-        fwrite(mem + min, len, 1, fp);
+        MemoryWriteFile(fp, banks[f], min, len);
 
         fclose(fp);
-
-        free(mem);
     }
 
     return TRUE;
@@ -52,7 +52,6 @@ int RawOutput(const char *filename, const char *filename_bank,
     {
         FILE *fp;
         const char *name;
-        Byte *mem;
         ulong min, max, len;
 
         if (count == 1)
@@ -75,9 +74,7 @@ int RawOutput(const char *filename, const char *filename_bank,
         max = GetHighWriteMarker(banks[f]);
         len = max - min + 1;
 
-        mem = MemoryGetBlock(banks[f], min, len);
-        fwrite(mem, 1, len, fp);
-        free(mem);
+        MemoryWriteFile(fp, banks[f], min, len);
 
         fclose(fp);
     }
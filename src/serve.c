@@ -0,0 +1,320 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Long running build server, as started with --serve.
+
+    The server keeps the tokenised sources loaded between builds, only
+    reading files that have changed, and forks to run each build.  The child
+    starts with none of the assembly state left by an earlier build, and any
+    fatal error in the build only ends the child.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CASM_POSIX
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#define CASM_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "global.h"
+#include "source.h"
+#include "serve.h"
+
+
+#ifdef CASM_POSIX
+
+/* ---------------------------------------- TYPES AND GLOBALS
+*/
+
+/* Files are watched through their directories, so that files an editor
+   saves by renaming a new copy over the old are still seen to change.
+*/
+typedef struct
+{
+    int         wd;
+    char        name[256];
+} Watch;
+
+static Watch    *watch;
+static int      no_watches;
+static int      watch_fd = -1;
+
+/* Commands read from stdin that haven't been acted on yet
+*/
+static char     input[1024];
+static size_t   input_len;
+
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+static int Build(const char *path, int (*assemble)(void))
+{
+    pid_t pid;
+    int status = EXIT_FAILURE;
+
+    if (SourceLoad(path) && SourceHasContents())
+    {
+        fflush(stdout);
+        fflush(stderr);
+
+        if ((pid = fork()) == 0)
+        {
+            exit(assemble());
+        }
+
+        if (pid > 0 && waitpid(pid, &status, 0) == pid)
+        {
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+        }
+    }
+
+    printf("build %s\n", status == EXIT_SUCCESS ? "ok" : "failed");
+    fflush(stdout);
+
+    return status;
+}
+
+
+#ifdef CASM_INOTIFY
+/* Watch the directories of all the files now making up the sources
+*/
+static void WatchSources(void)
+{
+    const char *path;
+    int f;
+
+    if (watch_fd == -1 && (watch_fd = inotify_init()) == -1)
+    {
+        return;
+    }
+
+    no_watches = 0;
+
+    for(f = 0; (path = SourceGetFile(f)); f++)
+    {
+        char dir[CASM_MAX_LINE_LENGTH];
+        const char *name = strrchr(path, '/');
+        int wd;
+
+        if (name)
+        {
+            snprintf(dir, sizeof dir, "%.*s", (int)(name - path + 1), path);
+            name++;
+        }
+        else
+        {
+            CopyStr(dir, ".", sizeof dir);
+            name = path;
+        }
+
+        wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                                                IN_CREATE | IN_DELETE);
+
+        if (wd != -1)
+        {
+            watch = Realloc(watch, (sizeof *watch) * (no_watches + 1));
+            watch[no_watches].wd = wd;
+            CopyStr(watch[no_watches].name, name, sizeof watch->name);
+            no_watches++;
+        }
+    }
+}
+
+
+/* Read waiting events, returning TRUE if any were for a watched file
+*/
+static int SourcesChanged(void)
+{
+    char buff[4096];
+    ssize_t len;
+    ssize_t pos;
+    int changed = FALSE;
+
+    if ((len = read(watch_fd, buff, sizeof buff)) <= 0)
+    {
+        return FALSE;
+    }
+
+    for(pos = 0; pos < len; )
+    {
+        struct inotify_event ev;
+        const char *name = buff + pos + sizeof ev;
+        int f;
+
+        memcpy(&ev, buff + pos, sizeof ev);
+
+        for(f = 0; f < no_watches && ev.len; f++)
+        {
+            if (watch[f].wd == ev.wd && strcmp(watch[f].name, name) == 0)
+            {
+                changed = TRUE;
+            }
+        }
+
+        pos += sizeof ev + ev.len;
+    }
+
+    return changed;
+}
+#endif
+
+
+/* Wait for the sources to change or a command.  Returns TRUE to build
+   again, FALSE to quit.
+*/
+static int Wait(void)
+{
+    while(TRUE)
+    {
+        char *nl;
+        fd_set fds;
+        int max = STDIN_FILENO;
+
+        /* Act on any complete command already read
+        */
+        while((nl = memchr(input, '\n', input_len)))
+        {
+            char cmd[sizeof input];
+            size_t len = nl - input + 1;
+
+            memcpy(cmd, input, len - 1);
+            cmd[len - 1] = 0;
+            memmove(input, input + len, input_len - len);
+            input_len -= len;
+
+            Trim(cmd);
+
+            if (CompareString(cmd, "build"))
+            {
+                return TRUE;
+            }
+            else if (CompareString(cmd, "quit"))
+            {
+                return FALSE;
+            }
+            else if (cmd[0])
+            {
+                printf("unknown command %s\n", cmd);
+                fflush(stdout);
+            }
+        }
+
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+
+        if (watch_fd != -1)
+        {
+            FD_SET(watch_fd, &fds);
+            max = watch_fd > max ? watch_fd : max;
+        }
+
+        if (select(max + 1, &fds, NULL, NULL, NULL) == -1)
+        {
+            return FALSE;
+        }
+
+#ifdef CASM_INOTIFY
+        if (watch_fd != -1 && FD_ISSET(watch_fd, &fds) && SourcesChanged())
+        {
+            struct timeval tv;
+
+            /* Editors often write a file in several steps, so wait for
+               things to go quiet before building
+            */
+            do
+            {
+                FD_ZERO(&fds);
+                FD_SET(watch_fd, &fds);
+                tv.tv_sec = 0;
+                tv.tv_usec = 50000;
+            } while(select(watch_fd + 1, &fds, NULL, NULL, &tv) > 0 &&
+                        (SourcesChanged() || TRUE));
+
+            return TRUE;
+        }
+#endif
+
+        if (FD_ISSET(STDIN_FILENO, &fds))
+        {
+            ssize_t got;
+
+            if (input_len == sizeof input)
+            {
+                input_len = 0;
+            }
+
+            got = read(STDIN_FILENO, input + input_len,
+                                        sizeof input - input_len);
+
+            if (got <= 0)
+            {
+                return FALSE;
+            }
+
+            input_len += got;
+        }
+    }
+}
+
+#endif
+
+
+/* ---------------------------------------- INTERFACES
+*/
+int Serve(const char *path, int (*assemble)(void))
+{
+#ifdef CASM_POSIX
+    if (!path || strcmp(path, "-") == 0)
+    {
+        fprintf(stderr, "--serve needs a file, as commands are read from "
+                                                                "stdin\n");
+        return EXIT_FAILURE;
+    }
+
+    do
+    {
+        Build(path, assemble);
+#ifdef CASM_INOTIFY
+        WatchSources();
+#endif
+    } while(Wait());
+
+    return EXIT_SUCCESS;
+#else
+    fprintf(stderr, "--serve is not supported on this system\n");
+    return EXIT_FAILURE;
+#endif
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
@@ -0,0 +1,49 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Long running build server, as started with --serve.
+
+*/
+
+#ifndef CASM_SERVE_H
+#define CASM_SERVE_H
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Repeatedly build the passed file until told to quit.  The sources are
+   loaded, and assemble is called to run the passes and write the output,
+   returning an exit status.  Each build is run in a copy of this process, so
+   assemble starts from the same state every time.
+
+   Builds happen when the sources change, or when "build" is read from
+   stdin.  "quit", or the end of stdin, stops the server.  After each build
+   a line of "build ok" or "build failed" is written to stdout.
+
+   Returns the exit status for the program.
+*/
+int     Serve(const char *path, int (*assemble)(void));
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
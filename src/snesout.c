@@ -35,6 +35,13 @@
 /* ---------------------------------------- MACROS & TYPES
 */
 
+/* The ROM header is built in a buffer and then written into bank memory.
+   HDR() converts a header address into an offset in that buffer.
+*/
+#define HEADER_ADDR     0xffc0
+#define HEADER_SIZE     0x40
+#define HDR(a)          ((a) - HEADER_ADDR)
+
 enum option_t
 {
     OPT_ROM_TYPE,
@@ -135,9 +142,19 @@ static int PokeS(Byte *mem, int addr, const char *str, int maxlen, char pad)
 
 static unsigned CalcChecksum(unsigned bank, int p, int len, unsigned csum)
 {
-    while(len-- > 0)
+    while(len > 0)
     {
-        csum += MemoryReadBank(bank, p++);
+        ulong run;
+        ulong f;
+        const Byte *mem = MemoryView(bank, p, len, &run);
+
+        for(f = 0; f < run; f++)
+        {
+            csum += mem[f];
+        }
+
+        p += run;
+        len -= run;
     }
 
     return csum & 0xffff;
@@ -242,18 +259,18 @@ int SNESOutput(const char *filename, const char *filename_bank,
 
     /* Setup ROM header
     */
-    mem = MemoryGetBlock(banks[0], 0, 0x10000);
+    mem = MemoryGetBlock(banks[0], HEADER_ADDR, HEADER_SIZE);
 
-    PokeS(mem, 0xffc0, option.name, 21, ' ');
+    PokeS(mem, HDR(0xffc0), option.name, 21, ' ');
 
-    PokeB(mem, 0xffd5, option.rom_type);
+    PokeB(mem, HDR(0xffd5), option.rom_type);
 
-    PokeW(mem, 0xfffc, option.start);
+    PokeW(mem, HDR(0xfffc), option.start);
 
     if (option.irq_vector[IRQ_VBLANK] != -1)
     {
-        PokeW(mem, 0xffea, option.irq_vector[IRQ_VBLANK]);
-        PokeW(mem, 0xfffa, option.irq_vector[IRQ_VBLANK]);
+        PokeW(mem, HDR(0xffea), option.irq_vector[IRQ_VBLANK]);
+        PokeW(mem, HDR(0xfffa), option.irq_vector[IRQ_VBLANK]);
     }
     else
     {
@@ -262,8 +279,8 @@ int SNESOutput(const char *filename, const char *filename_bank,
 
     if (option.irq_vector[IRQ_IRQ] != -1)
     {
-        PokeW(mem, 0xffee, option.irq_vector[IRQ_IRQ]);
-        PokeW(mem, 0xfffe, option.irq_vector[IRQ_IRQ]);
+        PokeW(mem, HDR(0xffee), option.irq_vector[IRQ_IRQ]);
+        PokeW(mem, HDR(0xfffe), option.irq_vector[IRQ_IRQ]);
     }
 
     /* TODO: What goes in 0xffd6 - ROM type? */
@@ -272,42 +289,41 @@ int SNESOutput(const char *filename, const char *filename_bank,
     {
         if (option.rom_type == ROM_LOROM || option.rom_type == ROM_LOROM_FAST)
         {
-            PokeB(mem, 0xffd7, count * 32);
+            PokeB(mem, HDR(0xffd7), count * 32);
         }
         else
         {
-            PokeB(mem, 0xffd7, count * 64);
+            PokeB(mem, HDR(0xffd7), count * 64);
         }
     }
     else
     {
-        PokeB(mem, 0xffd7, option.rom_size);
+        PokeB(mem, HDR(0xffd7), option.rom_size);
     }
 
-    PokeB(mem, 0xffd8, option.ram_size);
+    PokeB(mem, HDR(0xffd8), option.ram_size);
 
     /* Calculate checksum
     */
     csum = 0;
 
-    PokeW(mem, 0xffdc, 0xffff);
+    PokeW(mem, HDR(0xffdc), 0xffff);
+    MemoryWriteBlock(banks[0], HEADER_ADDR, mem, HEADER_SIZE);
 
     for(f = 0; f < count; f++)
     {
         csum = CalcChecksum(banks[f], base, len, csum);
     }
 
-    PokeW(mem, 0xffde, csum);
-    PokeW(mem, 0xffdc, csum ^ 0xffff);
+    PokeW(mem, HDR(0xffde), csum);
+    PokeW(mem, HDR(0xffdc), csum ^ 0xffff);
+    MemoryWriteBlock(banks[0], HEADER_ADDR, mem, HEADER_SIZE);
 
     /* Output ROM contents
     */
     for(f = 0; f < count; f++)
     {
-        Byte *m = MemoryGetBlock(banks[f], base, len);
-
-        fwrite(m, len, 1, fp);
-        free(m);
+        MemoryWriteFile(fp, banks[f], base, len);
     }
 
     fclose(fp);
@@ -25,174 +25,1298 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CASM_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "global.h"
 #include "source.h"
 #include "parse.h"
+#include "arena.h"
+#include "hash.h"
+#include "cache.h"
+
+#if defined(CASM_POSIX) && defined(CASM_HAVE_THREAD_LOCAL)
+#define CASM_USE_THREADS
+#include <pthread.h>
+#endif
 
 
 /* ---------------------------------------- TYPES AND GLOBALS
 */
-typedef struct SourceLine
+
+#define MAX_WORKERS     32
+
+struct SourceFile;
+
+/* A line is a slice of the file it came from, tokenised when loaded.  An
+   include line points to the file it includes, and says whether it should
+   only be included once.
+*/
+typedef struct
 {
-    char        *line;
-    const char  *filename;
+    size_t      offset;
+    size_t      length;
+    Line        tokens;
     int         line_number;
-    struct SourceLine *next;
+    struct SourceFile *include;
+    int         once;
+} FileLine;
+
+
+/* A loaded file.  The contents are either mapped or read into memory, and
+   each line is terminated in place so it can be used directly as a string.
+   Files are loaded independently of each other, so if loading fails the
+   error is kept to be reported after the lines before it.
+
+   A file is only loaded once however many times it's included.  identity
+   identifies the file on disk, so that it's found whatever path it's
+   included with, and is empty if it can't be found.  When the sources are
+   loaded again any file whose identity hasn't changed is reused.
+
+   A file that can't be opened is marked missing, and only fails the load if
+   it's the one being loaded, as an include of it may be in a conditional
+   block that's never run.  ran is the pass it was last included in.
+*/
+typedef struct SourceFile
+{
+    const char  *path;
+    char        identity[80];
+    char        *data;
+    size_t      size;
+    int         mapped;
+    Arena       *arena;
+    FileLine    *line;
+    int         no_lines;
+    int         lines_size;
+    char        *error;
+    char        *cached;
+    int         once;
+    int         missing;
+    unsigned    ran;
+    int         splicing;
+    int         reused;
+    struct SourceFile *next;
+    struct SourceFile *queued;
+} SourceFile;
+
+
+/* A path a file has been included with
+*/
+typedef struct IncludeName
+{
+    const char  *path;
+    SourceFile  *file;
+    struct IncludeName *next;
+} IncludeName;
+
+
+/* The sources as they're run, with the included files spliced in.  Every
+   include is followed by the lines of the file it includes, whether or not
+   it's to be included once, as that's only known when the include is run.
+   The include's block_end is after them so they can be skipped.  An include
+   of a file that's already being spliced is marked recursive instead.
+*/
+typedef struct
+{
+    SourceFile  *file;
+    FileLine    *line;
+    CompiledExpr *exprs;
+    void        *command;
+    int         block_end;
+    int         recursive;
 } SourceLine;
 
-static SourceLine       *head;
-static SourceLine       *tail;
-static SourceLine       *current;
+static SourceFile       *files;
+
+static HashTable        *by_path;
+static HashTable        *by_identity;
+static IncludeName      *names;
+
+/* Files from the previous load that can be reused
+*/
+static HashTable        *previous;
+static SourceFile       **previous_file;
+static int              no_previous;
+
+static SourceLine       *lines;
+static int              no_lines;
+static int              lines_size;
+static int              current;
+
+/* The file the sources were loaded from, and the number of the pass being
+   run, counting every pass since the sources were first loaded
+*/
+static SourceFile       *root;
+static unsigned         runs = 1;
+
+
+/* Files waiting to be loaded, and the number waiting or being loaded
+*/
+static SourceFile       *queue_head;
+static SourceFile       *queue_tail;
+static int              outstanding;
+
+#ifdef CASM_USE_THREADS
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   wake = PTHREAD_COND_INITIALIZER;
+static pthread_t        worker[MAX_WORKERS];
+static int              no_workers;
+static int              workers_started;
+#define LOCK()          pthread_mutex_lock(&lock)
+#define UNLOCK()        pthread_mutex_unlock(&lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
 
 /* ---------------------------------------- PRIVATE FUNCTIONS
 */
-static void AddSourceLine(char *line, const char *filename, int line_number)
+static void Fail(SourceFile *file, const char *fmt, ...)
 {
-    SourceLine *new = Malloc(sizeof *new);
+    char buff[CASM_MAX_LINE_LENGTH];
+    va_list va;
 
-    new->line = line;
-    new->filename = filename;
+    va_start(va, fmt);
+    vsnprintf(buff, sizeof buff, fmt, va);
+    va_end(va);
+
+    file->error = ArenaDupStr(file->arena, buff);
+}
+
+
+static void AddFileLine(SourceFile *file, size_t offset, size_t length,
+                        const Line *tokens, int line_number)
+{
+    FileLine *new;
+
+    if (file->no_lines == file->lines_size)
+    {
+        file->lines_size = file->lines_size ? file->lines_size * 2 : 256;
+        file->line = Realloc(file->line,
+                             (sizeof *file->line) * file->lines_size);
+    }
+
+    new = file->line + file->no_lines++;
+
+    new->offset = offset;
+    new->length = length;
+    new->tokens = *tokens;
     new->line_number = line_number;
-    new->next = NULL;
+    new->include = NULL;
+    new->once = FALSE;
+}
+
+
+static void AddSourceLine(SourceFile *file, FileLine *line)
+{
+    SourceLine *new;
+
+    if (no_lines == lines_size)
+    {
+        lines_size = lines_size ? lines_size * 2 : 1024;
+        lines = Realloc(lines, (sizeof *lines) * lines_size);
+    }
+
+    new = lines + no_lines++;
+
+    new->file = file;
+    new->line = line;
+    new->exprs = NULL;
+    new->command = NULL;
+    new->block_end = no_lines;
+    new->recursive = FALSE;
+}
+
+
+/* Read the whole of a stream into memory, leaving room for a terminator
+*/
+static int ReadFile(SourceFile *file, FILE *fp)
+{
+    size_t size = 0;
+    size_t len = 0;
+    size_t got;
+
+    file->data = NULL;
+
+    do
+    {
+        if (size - len < 4096)
+        {
+            size += 65536;
+            file->data = Realloc(file->data, size);
+        }
+
+        got = fread(file->data + len, 1, size - len - 1, fp);
+        len += got;
+    } while(got > 0);
+
+    file->size = len;
+    file->mapped = FALSE;
+
+    return !ferror(fp);
+}
+
+
+/* Load a file's contents, mapping it when possible
+*/
+static int LoadFile(SourceFile *file)
+{
+    FILE *fp;
+    int ok;
+
+#ifdef CASM_POSIX
+    int fd;
+    struct stat st;
+
+    if ((fd = open(file->path, O_RDONLY)) == -1)
+    {
+        return FALSE;
+    }
+
+    /* The mapping is private and writable so lines can be terminated in
+       place.  The terminator after the last line needs a spare byte, which
+       only exists if the file doesn't end on a page boundary or already
+       ends with a newline.
+    */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *p;
+
+        file->size = st.st_size;
+
+        p = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (p != MAP_FAILED)
+        {
+            file->data = p;
+            file->mapped = TRUE;
+
+            if (file->data[file->size - 1] == '\n' ||
+                    file->size % sysconf(_SC_PAGESIZE) != 0)
+            {
+                close(fd);
+                return TRUE;
+            }
+
+            munmap(p, file->size);
+        }
+    }
+
+    close(fd);
+#endif
+
+    if (!(fp = fopen(file->path, "r")))
+    {
+        return FALSE;
+    }
+
+    ok = ReadFile(file, fp);
 
-    if (tail)
+    fclose(fp);
+
+    return ok;
+}
+
+
+static SourceFile *NewFile(const char *path)
+{
+    SourceFile *file = Malloc(sizeof *file);
+
+    file->path = path;
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = FALSE;
+    file->arena = NULL;
+    file->line = NULL;
+    file->no_lines = 0;
+    file->lines_size = 0;
+    file->error = NULL;
+    file->cached = NULL;
+    file->once = FALSE;
+    file->missing = FALSE;
+    file->ran = 0;
+    file->splicing = FALSE;
+    file->reused = FALSE;
+    file->queued = NULL;
+    file->identity[0] = 0;
+
+    return file;
+}
+
+
+static void FreeFile(SourceFile *f)
+{
+#ifdef CASM_POSIX
+    if (f->mapped)
     {
-        tail->next = new;
-        tail = new;
+        munmap(f->data, f->size);
     }
     else
+#endif
     {
-        head = new;
-        tail = new;
+        free(f->data);
     }
+
+    ArenaFree(f->arena);
+    free(f->cached);
+    free(f->line);
+    free(f);
 }
 
-/* ---------------------------------------- INTERFACES
+
+#ifdef CASM_USE_THREADS
+static void *Worker(void *arg);
+#endif
+
+/* Queue a file to be loaded.  The workers are only started once there's
+   more than one file, so a source without includes costs no threads.
 */
-int SourceLoad(const char *path)
+static void Submit(SourceFile *file)
 {
-    int line_no = 1;
-    char buff[CASM_MAX_LINE_LENGTH];
-    FILE *fp;
+    LOCK();
 
-    if (!path || strcmp(path, "-") == 0)
+    file->next = files;
+    file->queued = NULL;
+    files = file;
+
+    if (queue_tail)
     {
-        fp = stdin;
-        path = "(stdin)";
+        queue_tail->queued = file;
     }
     else
     {
-        fp = fopen(path, "r");
+        queue_head = file;
+    }
+
+    queue_tail = file;
+    outstanding++;
+
+#ifdef CASM_USE_THREADS
+    if (!workers_started && files->next)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        workers_started = TRUE;
+
+        while(no_workers < MAX_WORKERS && no_workers < cpus - 1 &&
+                pthread_create(worker + no_workers, NULL, Worker, NULL) == 0)
+        {
+            no_workers++;
+        }
+    }
+
+    pthread_cond_signal(&wake);
+#endif
+
+    UNLOCK();
+}
+
+
+/* Find the file for an include, queueing it to be loaded if it's not been
+   seen before.  Files are looked for first by the path they're included
+   with, which needs no access to the filesystem, and then by where and
+   what they are on disk.  The hash tables ignore case, so a path found must
+   still be checked.
+*/
+static SourceFile *Include(const char *path)
+{
+    SourceFile *file = NULL;
+    IncludeName *name;
+    char identity[80] = "";
+    int is_new = FALSE;
+
+    LOCK();
+
+    if ((name = HashFind(by_path, path)) && strcmp(name->path, path) == 0)
+    {
+        file = name->file;
+    }
+
+    UNLOCK();
+
+    if (file)
+    {
+        return file;
+    }
+
+#ifdef CASM_POSIX
+    {
+        struct stat st;
+
+        if (stat(path, &st) == 0)
+        {
+            unsigned long nsec = 0;
+
+#if defined(__linux__)
+            nsec = st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+            nsec = st.st_mtimespec.tv_nsec;
+#endif
+            snprintf(identity, sizeof identity, "%lx:%lx:%lx:%lx.%lx",
+                                            (unsigned long)st.st_dev,
+                                            (unsigned long)st.st_ino,
+                                            (unsigned long)st.st_size,
+                                            (unsigned long)st.st_mtime,
+                                            nsec);
+        }
+    }
+#endif
+
+    LOCK();
+
+    if (identity[0])
+    {
+        file = HashFind(by_identity, identity);
+
+        if (!file && previous && (file = HashFind(previous, identity)))
+        {
+            if (file->reused)
+            {
+                file = NULL;
+            }
+            else
+            {
+                /* The path it was found by may have gone with the file
+                   that included it
+                */
+                file->path = path;
+                file->reused = TRUE;
+                HashAdd(by_identity, file->identity, file);
+                is_new = TRUE;
+            }
+        }
+    }
+
+    if (!file)
+    {
+        file = NewFile(path);
+        is_new = TRUE;
+
+        if (identity[0])
+        {
+            CopyStr(file->identity, identity, sizeof file->identity);
+            HashAdd(by_identity, file->identity, file);
+        }
+    }
+
+    name = Malloc(sizeof *name);
+    name->path = path;
+    name->file = file;
+    name->next = names;
+    names = name;
+    HashAdd(by_path, name->path, name);
+
+    UNLOCK();
+
+    if (is_new)
+    {
+        Submit(file);
+    }
+
+    return file;
+}
+
+
+/* Tokenised lines are kept in the persistent cache as a series of records.
+   Each is the line length, flags, and token count, then each token as its
+   quote character and text.  Numbers are written as 4 bytes, low first.
+*/
+#define CACHED_FIRST_COLUMN     1
+#define CACHED_COMMENT          2
+
+typedef struct
+{
+    char        *data;
+    size_t      len;
+    size_t      size;
+} Buffer;
+
+
+static void Put(Buffer *b, const void *data, size_t len)
+{
+    if (b->size - b->len < len)
+    {
+        b->size = (b->size + len) * 2;
+        b->data = Realloc(b->data, b->size);
+    }
+
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+
+static void PutNumber(Buffer *b, unsigned long n)
+{
+    unsigned char c[4];
+
+    c[0] = n & 0xff;
+    c[1] = (n >> 8) & 0xff;
+    c[2] = (n >> 16) & 0xff;
+    c[3] = (n >> 24) & 0xff;
+
+    Put(b, c, 4);
+}
+
+
+static int GetNumber(const char **p, const char *end, unsigned long *n)
+{
+    const unsigned char *c = (const unsigned char *)*p;
+
+    if (end - *p < 4)
+    {
+        return FALSE;
+    }
+
+    *n = c[0] | (c[1] << 8) | ((unsigned long)c[2] << 16) |
+                                        ((unsigned long)c[3] << 24);
+    *p += 4;
+
+    return TRUE;
+}
+
+
+static int GetString(const char **p, const char *end, char **s)
+{
+    const char *nul = memchr(*p, 0, end - *p);
+
+    if (!nul)
+    {
+        return FALSE;
+    }
+
+    *s = (char *)*p;
+    *p = nul + 1;
+
+    return TRUE;
+}
+
+
+/* Read a line from the cache.  The token text is used where it lies in the
+   cache data.  Returns FALSE if the cache doesn't hold the line expected.
+*/
+static int ReadCachedLine(SourceFile *file, const char **p, const char *end,
+                          size_t length, Line *line)
+{
+    unsigned long len;
+    unsigned long flags;
+    unsigned long count;
+    unsigned long f;
+
+    if (!GetNumber(p, end, &len) || len != length ||
+            !GetNumber(p, end, &flags) || !GetNumber(p, end, &count) ||
+            count > (unsigned long)(end - *p))
+    {
+        return FALSE;
+    }
+
+    line->first_column = (flags & CACHED_FIRST_COLUMN) != 0;
+    line->no_tokens = count;
+    line->token = NULL;
+    line->quoted = NULL;
+    line->comment = NULL;
+    line->arena = file->arena;
+
+    if (count)
+    {
+        line->token = ArenaAlloc(file->arena, (sizeof *line->token) * count);
+        line->quoted = ArenaAlloc(file->arena, (sizeof *line->quoted) * count);
+    }
+
+    for(f = 0; f < count; f++)
+    {
+        unsigned long quote;
 
-        if (!fp)
+        if (!GetNumber(p, end, &quote) || !GetString(p, end, line->token + f))
         {
-            fprintf(stderr, "Failed to open '%s'\n", path);
             return FALSE;
         }
+
+        line->quoted[f] = quote;
     }
 
-    while(fgets(buff, sizeof buff, fp))
+    if ((flags & CACHED_COMMENT) && !GetString(p, end, &line->comment))
+    {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static void WriteCachedLines(SourceFile *file, const char *key)
+{
+    Buffer b = {NULL, 0, 0};
+    int l;
+    int f;
+
+    for(l = 0; l < file->no_lines; l++)
     {
+        const FileLine *line = file->line + l;
+        const Line *t = &line->tokens;
+
+        PutNumber(&b, line->length);
+        PutNumber(&b, (t->first_column ? CACHED_FIRST_COLUMN : 0) |
+                        (t->comment ? CACHED_COMMENT : 0));
+        PutNumber(&b, t->no_tokens);
+
+        for(f = 0; f < t->no_tokens; f++)
+        {
+            PutNumber(&b, t->quoted[f]);
+            Put(&b, t->token[f], strlen(t->token[f]) + 1);
+        }
+
+        if (t->comment)
+        {
+            Put(&b, t->comment, strlen(t->comment) + 1);
+        }
+    }
+
+    CacheWrite(key, b.data, b.len);
+    free(b.data);
+}
+
+
+/* Split a file into lines, parsing each and queueing any files they include.
+   If there's a persistent cache then the tokens are taken from it when the
+   file has been seen before.
+*/
+static void Process(SourceFile *file)
+{
+    int line_no = 1;
+    size_t offset = 0;
+    char key[CACHE_KEY_SIZE];
+    const char *cached = NULL;
+    const char *cached_end = NULL;
+    int all_cached = FALSE;
+    int f;
+
+    /* A file reused from an earlier load only needs its includes finding
+       again, as they may have changed
+    */
+    if (file->reused)
+    {
+        for(f = 0; f < file->no_lines; f++)
+        {
+            FileLine *l = file->line + f;
+
+            if (l->include)
+            {
+                l->include = Include(l->tokens.token[1]);
+            }
+        }
+
+        return;
+    }
+
+    file->arena = ArenaCreate();
+
+    if (!file->data && !LoadFile(file))
+    {
+        Fail(file, "Failed to open '%s'", file->path);
+        file->missing = TRUE;
+        return;
+    }
+
+    /* The key has to come from the contents before the lines are
+       terminated in place
+    */
+    if (CacheEnabled())
+    {
+        size_t size;
+
+        CacheKey(key, "tokens2", file->data, file->size);
+
+        if ((file->cached = CacheRead(key, &size)))
+        {
+            cached = file->cached;
+            cached_end = cached + size;
+            all_cached = TRUE;
+        }
+    }
+
+    while(offset < file->size)
+    {
+        char *text = file->data + offset;
+        char *nl = memchr(text, '\n', file->size - offset);
+        size_t length = nl ? (size_t)(nl - text) : file->size - offset;
         Line line;
 
-        RemoveNL(buff);
+        text[length] = 0;
 
-        if (!ParseLine(&line, buff))
+        if (cached && !ReadCachedLine(file, &cached, cached_end, length, &line))
         {
-            fprintf(stderr, "%s:%d %s\n", path, line_no, ParseError());
-            ParseFree(&line);
-            return FALSE;
+            cached = NULL;
+            all_cached = FALSE;
         }
 
-        AddSourceLine(DupStr(buff), path, line_no);
+        if (!cached && !ParseLine(&line, text, file->arena))
+        {
+            Fail(file, "%s:%d %s", file->path, line_no, ParseError());
+            return;
+        }
+
+        /* The tokenised line is kept, so passes don't need to parse it
+           again.  This also keeps the include path alive for the filename
+           of included lines.
+        */
+        AddFileLine(file, offset, length, &line, line_no);
         line_no++;
+        offset += length + 1;
 
-        if (line.no_tokens == 2 &&
+        if ((line.no_tokens == 2 || (line.no_tokens == 3 &&
+                                CompareString(line.token[2], "once"))) &&
                 (CompareString(line.token[0], "include") ||
                   CompareString(line.token[0], ".include")))
         {
-            if (!SourceLoad(line.token[1]))
-            {
-                ParseFree(&line);
-                return FALSE;
-            }
+            FileLine *l = file->line + file->no_lines - 1;
+
+            l->include = Include(line.token[1]);
+            l->once = line.no_tokens == 3;
+        }
+        else if (line.no_tokens == 1 && !line.first_column &&
+                    (CompareString(line.token[0], "once") ||
+                      CompareString(line.token[0], ".once")))
+        {
+            file->once = TRUE;
+        }
+    }
+
+    if (CacheEnabled() && !all_cached)
+    {
+        WriteCachedLines(file, key);
+    }
+}
+
+
+/* Load queued files until there are none left waiting or being loaded
+*/
+static void Work(void)
+{
+    LOCK();
+
+    while(outstanding > 0)
+    {
+        SourceFile *file = queue_head;
+
+        if (!file)
+        {
+#ifdef CASM_USE_THREADS
+            pthread_cond_wait(&wake, &lock);
+#endif
+            continue;
+        }
+
+        queue_head = file->queued;
+
+        if (!queue_head)
+        {
+            queue_tail = NULL;
         }
 
-        ParseFree(&line);
+        UNLOCK();
+        Process(file);
+        LOCK();
+
+        if (--outstanding == 0)
+        {
+#ifdef CASM_USE_THREADS
+            pthread_cond_broadcast(&wake);
+#endif
+        }
     }
 
-    if (fp != stdin)
+    UNLOCK();
+}
+
+
+#ifdef CASM_USE_THREADS
+static void *Worker(void *arg)
+{
+    Work();
+    ParseFreeThread();
+    return NULL;
+}
+#endif
+
+
+/* Add a loaded file's lines to the sources, splicing in the files it
+   includes.  Errors are reported as they're reached, so the first one in
+   source order is the one reported.  Missing and recursive includes are left
+   to be reported if they're run.
+*/
+static int Splice(SourceFile *file)
+{
+    int f;
+
+    file->splicing = TRUE;
+
+    for(f = 0; f < file->no_lines; f++)
     {
-        fclose(fp);
+        FileLine *l = file->line + f;
+        SourceFile *inc = l->include;
+        int include_line = no_lines;
+
+        AddSourceLine(file, l);
+
+        if (!inc)
+        {
+            continue;
+        }
+
+        if (inc->splicing)
+        {
+            lines[include_line].recursive = TRUE;
+            continue;
+        }
+
+        if (!Splice(inc))
+        {
+            return FALSE;
+        }
+
+        lines[include_line].block_end = no_lines;
     }
 
-    current = head;
+    file->splicing = FALSE;
+
+    if (file->error && !file->missing)
+    {
+        fprintf(stderr, "%s\n", file->error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Find the line that ends each conditional block, so that a block that isn't
+   run can be jumped over.  An if, elseif or else is ended by the next elseif,
+   else or endif at the same depth.  Lines that aren't conditionals end where
+   they are, and blocks that are never closed end at the end of the sources.
+*/
+static void MatchConditionals(void)
+{
+    int *open = NULL;
+    int no_open = 0;
+    int open_size = 0;
+    int l;
+
+    for(l = 0; l < no_lines; l++)
+    {
+        switch(SourceConditional(&lines[l].line->tokens))
+        {
+            case COND_IF:
+            case COND_IFDEF:
+            case COND_IFNDEF:
+                if (no_open == open_size)
+                {
+                    open_size = open_size ? open_size * 2 : 16;
+                    open = Realloc(open, (sizeof *open) * open_size);
+                }
+
+                open[no_open++] = l;
+                break;
+
+            case COND_ELSEIF:
+            case COND_ELSE:
+                if (no_open)
+                {
+                    lines[open[no_open - 1]].block_end = l;
+                    open[no_open - 1] = l;
+                }
+                break;
+
+            case COND_ENDIF:
+                if (no_open)
+                {
+                    lines[open[--no_open]].block_end = l;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    while(no_open)
+    {
+        lines[open[--no_open]].block_end = no_lines;
+    }
+
+    free(open);
+}
+
+
+/* Put aside the files from a previous load so unchanged ones can be reused.
+   Files that failed to load, or can't be found again, are dropped.
+*/
+static void Forget(void)
+{
+    int l;
+
+    for(l = 0; l < no_lines; l++)
+    {
+        free(lines[l].command);
+    }
+
+    no_lines = 0;
+
+    while(names)
+    {
+        IncludeName *n = names;
+
+        names = names->next;
+        free(n);
+    }
+
+    HashClear(by_path);
+    HashClear(by_identity);
+
+    previous = HashCreate();
+
+    while(files)
+    {
+        SourceFile *f = files;
+
+        files = files->next;
+
+        if (f->identity[0] && !f->error)
+        {
+            previous_file = Realloc(previous_file,
+                                    (sizeof *previous_file) * (no_previous + 1));
+            previous_file[no_previous++] = f;
+            f->reused = FALSE;
+            HashAdd(previous, f->identity, f);
+        }
+        else
+        {
+            FreeFile(f);
+        }
+    }
+}
+
+
+/* Free the files put aside by Forget() that weren't reused
+*/
+static void ForgetPrevious(void)
+{
+    int f;
+
+    for(f = 0; f < no_previous; f++)
+    {
+        if (!previous_file[f]->reused)
+        {
+            FreeFile(previous_file[f]);
+        }
+    }
+
+    free(previous_file);
+    HashFree(previous);
+
+    previous_file = NULL;
+    no_previous = 0;
+    previous = NULL;
+}
+
+
+/* ---------------------------------------- INTERFACES
+*/
+int SourceLoad(const char *path)
+{
+    SourceFile *file;
+
+    if (!by_path)
+    {
+        by_path = HashCreate();
+        by_identity = HashCreate();
+    }
+    else
+    {
+        Forget();
+    }
+
+    /* Included files are loaded by the workers as they're found, with this
+       thread helping, and then put in order once they're all loaded
+    */
+    if (!path || strcmp(path, "-") == 0)
+    {
+        file = NewFile("(stdin)");
+
+        if (!ReadFile(file, stdin))
+        {
+            fprintf(stderr, "Failed to read '%s'\n", file->path);
+            return FALSE;
+        }
+
+        Submit(file);
+    }
+    else
+    {
+        file = Include(path);
+    }
+
+    Work();
+
+#ifdef CASM_USE_THREADS
+    while(no_workers > 0)
+    {
+        pthread_join(worker[--no_workers], NULL);
+    }
+
+    workers_started = FALSE;
+#endif
+
+    if (previous)
+    {
+        ForgetPrevious();
+    }
+
+    current = 0;
+    root = file;
+    root->ran = runs;
+
+    if (file->missing)
+    {
+        fprintf(stderr, "%s\n", file->error);
+        return FALSE;
+    }
+
+    if (!Splice(file))
+    {
+        return FALSE;
+    }
+
+    MatchConditionals();
 
     return TRUE;
 }
 
 int SourceHasContents(void)
 {
-    return head != NULL;
+    return no_lines > 0;
 }
 
 void SourceRewind(void)
 {
-    current = head;
+    current = 0;
+    root->ran = ++runs;
 }
 
-int SourceRead(char buff[], size_t maxlen)
+int SourceRead(const char **text, const Line **line)
 {
-    if (!current)
+    if (current >= no_lines)
     {
         return 0;
     }
 
-    CopyStr(buff, current->line, maxlen);
+    *text = lines[current].file->data + lines[current].line->offset;
+    *line = &lines[current].line->tokens;
     return 1;
 }
 
+CompiledExpr **SourceExprCache(void)
+{
+    return &lines[current].exprs;
+}
+
+void **SourceCommandCache(void)
+{
+    return &lines[current].command;
+}
+
 void SourceNext(void)
 {
-    if (current)
+    if (current < no_lines)
     {
-        current = current->next;
+        current++;
     }
 }
 
+ConditionalType SourceConditional(const Line *line)
+{
+    int offset = line->first_column ? 1 : 0;
+    const char *p;
+
+    if (line->no_tokens <= offset)
+    {
+        return COND_NONE;
+    }
+
+    /* Most lines can be ruled out by the first letter, as every line is
+       checked when loaded
+    */
+    p = line->token[offset];
+
+    if (*p == '.')
+    {
+        p++;
+    }
+
+    switch(*p)
+    {
+        case 'i':
+        case 'I':
+            if (CompareString(p, "if"))
+            {
+                return COND_IF;
+            }
+            else if (CompareString(p, "ifdef"))
+            {
+                return COND_IFDEF;
+            }
+            else if (CompareString(p, "ifndef"))
+            {
+                return COND_IFNDEF;
+            }
+            break;
+
+        case 'e':
+        case 'E':
+            if (CompareString(p, "elseif"))
+            {
+                return COND_ELSEIF;
+            }
+            else if (CompareString(p, "else"))
+            {
+                return COND_ELSE;
+            }
+            else if (CompareString(p, "endif"))
+            {
+                return COND_ENDIF;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return COND_NONE;
+}
+
+void SourceSkipBlock(void)
+{
+    if (current < no_lines)
+    {
+        current = lines[current].block_end - 1;
+    }
+}
+
+int SourceInclude(char *err, size_t err_size)
+{
+    SourceLine *l;
+    SourceFile *inc;
+
+    if (current >= no_lines || !(inc = lines[current].line->include))
+    {
+        return TRUE;
+    }
+
+    l = lines + current;
+
+    if (inc->ran == runs && (l->line->once || inc->once))
+    {
+        current = l->block_end - 1;
+        return TRUE;
+    }
+
+    if (l->recursive)
+    {
+        snprintf(err, err_size, "Recursive include of '%s'", inc->path);
+        return FALSE;
+    }
+
+    if (inc->missing)
+    {
+        CopyStr(err, inc->error, err_size);
+        return FALSE;
+    }
+
+    inc->ran = runs;
+
+    return TRUE;
+}
+
+/* Errors found at the end of the sources, such as an unterminated macro, are
+   reported against the last line
+*/
 const char *SourceGetPath(void)
 {
-    return current->filename;
+    return lines[current < no_lines ? current : no_lines - 1].file->path;
 }
 
 int SourceGetLineNumber(void)
 {
-    return current->line_number;
+    return lines[current < no_lines ? current : no_lines - 1].line->line_number;
+}
+
+const char *SourceGetFile(int index)
+{
+    SourceFile *f;
+
+    for(f = files; f && index > 0; f = f->next)
+    {
+        index--;
+    }
+
+    return f ? f->path : NULL;
 }
 
 void *SourceGetBookmark(void)
 {
-    return current;
+    return lines + current;
 }
 
 void SourceSeek(void *bookmark)
 {
-    current = bookmark;
+    current = (SourceLine *)bookmark - lines;
 }
 
 void SourceFree(void)
 {
-    SourceLine *l = head;
+    int l;
 
-    while(l)
+    for(l = 0; l < no_lines; l++)
     {
-        SourceLine *t = l;
+        free(lines[l].command);
+    }
 
-        free(l->line);
-        l = l->next;
-        free(t);
+    while(files)
+    {
+        SourceFile *f = files;
+
+        files = files->next;
+        FreeFile(f);
     }
+
+    while(names)
+    {
+        IncludeName *n = names;
+
+        names = names->next;
+        free(n);
+    }
+
+    HashFree(by_path);
+    HashFree(by_identity);
+    free(lines);
+
+    by_path = NULL;
+    by_identity = NULL;
+    files = NULL;
+    lines = NULL;
+    no_lines = 0;
+    lines_size = 0;
+    current = 0;
+    root = NULL;
 }
 
 /*
@@ -26,12 +26,35 @@
 #ifndef CASM_SOURCE_H
 #define CASM_SOURCE_H
 
+#include "parse.h"
+#include "expr.h"
+
+/* ---------------------------------------- TYPES
+*/
+
+/* Conditional assembly directives
+*/
+typedef enum
+{
+    COND_NONE,
+    COND_IF,
+    COND_IFDEF,
+    COND_IFNDEF,
+    COND_ELSEIF,
+    COND_ELSE,
+    COND_ENDIF
+} ConditionalType;
+
+
 /* ---------------------------------------- INTERFACES
 */
 
 /* Read file data from passed file.  If the path is "-" then stdin is read.
    Will interpret and process include files.  Returns TRUE if the file was
    read OK, otherwise FALSE.
+
+   Can be called again to reload the sources, in which case files that
+   haven't changed since the last load are not read again.
 */
 int     SourceLoad(const char *path);
 
@@ -43,14 +66,46 @@ int     SourceHasContents(void);
 */
 void    SourceRewind(void);
 
-/* Get the current line.  Returns FALSE at the end of the sources.
+/* Get the current line, both as text and in the tokenised form it was parsed
+   into when loaded.  Both are owned by the sources and must not be altered.
+   Returns FALSE at the end of the sources.
 */
-int     SourceRead(char buff[], size_t maxlen);
+int     SourceRead(const char **text, const Line **line);
+
+/* Get the list the current line keeps its compiled expressions in, for use
+   with ExprSetCache().
+*/
+CompiledExpr **SourceExprCache(void);
+
+/* Get a place the current line can keep what its command was found to be.
+   It starts as NULL, and anything stored in it is released with free().
+*/
+void    **SourceCommandCache(void);
 
 /* Advance to the next line
 */
 void    SourceNext(void);
 
+/* Find which conditional directive a tokenised line holds, if any.  These are
+   found by the names as written rather than through aliases, so that the
+   blocks can be matched up when the sources are loaded.
+*/
+ConditionalType SourceConditional(const Line *line);
+
+/* Skip the lines of the conditional block the current line starts, so that
+   SourceNext() moves to the elseif, else or endif that ends it, or to the end
+   of the sources if nothing does.  The skipped lines aren't looked at.
+*/
+void    SourceSkipBlock(void);
+
+/* Run the include on the current line, if it is one.  The lines of the file
+   it includes follow it, and are skipped so SourceNext() moves past them if
+   the file has already been included this pass and either the line or the
+   file says it's only to be included once.  Returns FALSE with the error in
+   err if the file is missing or includes itself.
+*/
+int     SourceInclude(char *err, size_t err_size);
+
 /* Get the source filename for the current line
 */
 const char *SourceGetPath(void);
@@ -59,6 +114,11 @@ const char *SourceGetPath(void);
 */
 int     SourceGetLineNumber(void);
 
+/* Get the path of one of the files the sources were loaded from, by index
+   from zero.  Returns NULL when there are no more.
+*/
+const char *SourceGetFile(int index);
+
 /* Get a bookmark to the current line
 */
 void    *SourceGetBookmark(void);
@@ -30,6 +30,7 @@
 #include "label.h"
 #include "parse.h"
 #include "cmd.h"
+#include "hash.h"
 #include "codepage.h"
 
 #include "spc700.h"
@@ -1968,13 +1969,78 @@ static const HandlerTable handler_table[] =
 
 
 
+/* ---------------------------------------- OPCODE INDEX
+*/
+
+/* The opcode tables are indexed by name the first time the CPU is
+   initialised.  Only one of the table pointers is set for each name.
+*/
+typedef struct
+{
+    const OpcodeTable    *implied;
+    const OpcodeTable    *branch;
+    const HandlerTable   *handler;
+} OpcodeIndex;
+
+static HashTable        *opcode_index;
+
+
+/* Adds an opcode to the index.  Names already indexed are left alone, so the
+   tables are added in the order they used to be searched in.
+*/
+static void AddOpcode(const char *op, const OpcodeTable *implied,
+                      const OpcodeTable *branch, const HandlerTable *handler)
+{
+    OpcodeIndex *i;
+
+    if (HashFind(opcode_index, op))
+    {
+        return;
+    }
+
+    i = Malloc(sizeof *i);
+    i->implied = implied;
+    i->branch = branch;
+    i->handler = handler;
+
+    HashAdd(opcode_index, op, i);
+}
+
+
+static void IndexOpcodes(void)
+{
+    int f;
+
+    opcode_index = HashCreate();
+
+    for(f = 0; implied_opcodes[f].op; f++)
+    {
+        AddOpcode(implied_opcodes[f].op, implied_opcodes + f, NULL, NULL);
+    }
+
+    for(f = 0; branch_opcodes[f].op; f++)
+    {
+        AddOpcode(branch_opcodes[f].op, NULL, branch_opcodes + f, NULL);
+    }
+
+    for(f = 0; handler_table[f].op; f++)
+    {
+        AddOpcode(handler_table[f].op, NULL, NULL, handler_table + f);
+    }
+}
+
+
 /* ---------------------------------------- PUBLIC FUNCTIONS
 */
 
 void Init_SPC700(void)
 {
+    if (!opcode_index)
+    {
+        IndexOpcodes();
+    }
+
     option.dp_mode = DP_AUTO;
-    SetNeededPasses(3);
 }
 
 
@@ -2007,53 +2073,49 @@ CommandStatus SetOption_SPC700(int opt, int argc, char *argv[],
 CommandStatus Handler_SPC700(const char *label, int argc, char *argv[],       
                              int quoted[], char *err, size_t errsize)
 {
-    int f;
+    const OpcodeIndex *op = HashFind(opcode_index, argv[0]);
+
+    if (!op)
+    {
+        return CMD_NOT_KNOWN;
+    }
 
     /* Check for simple (implied addressing) opcodes
     */
-    for(f = 0; implied_opcodes[f].op; f++)
+    if (op->implied)
     {
-        if (CompareString(argv[0], implied_opcodes[f].op))
-        {
-            PCWrite(implied_opcodes[f].code);
-            return CMD_OK;
-        }
+        PCWrite(op->implied->code);
+        return CMD_OK;
     }
 
     /* Check for branch opcodes
     */
-    for(f = 0; branch_opcodes[f].op; f++)
+    if (op->branch)
     {
-        if (CompareString(argv[0], branch_opcodes[f].op))
-        {
-            long offset;
+        long offset;
 
-            CMD_ARGC_CHECK(2);
+        CMD_ARGC_CHECK(2);
 
-            CMD_EXPR(argv[1], offset);
+        CMD_EXPR(argv[1], offset);
 
-            if (!MakeRelative(&offset, argv[0], err, errsize))
-            {
-                return CMD_FAILED;
-            }
+        if (!MakeRelative(&offset, argv[0], err, errsize))
+        {
+            return CMD_FAILED;
+        }
 
-            PCWrite(branch_opcodes[f].code);
-            PCWrite(offset);
+        PCWrite(op->branch->code);
+        PCWrite(offset);
 
-            return CMD_OK;
-        }
+        return CMD_OK;
     }
 
 
     /* Check for other opcodes
     */
-    for(f = 0; handler_table[f].op; f++)
+    if (op->handler)
     {
-        if (CompareString(argv[0], handler_table[f].op))
-        {
-            return handler_table[f].cmd(label, argc, argv,
-                                        quoted, err, errsize);;
-        }
+        return op->handler->cmd(label, argc, argv,
+                                quoted, err, errsize);;
     }
 
 
@@ -35,8 +35,17 @@
 
 /* ---------------------------------------- TYPES AND GLOBALS
 */
+
+/* Passes are run until one goes by where every value used was the value it
+   ended up with.  MAX_PASSES stops code that never settles running forever.
+*/
+#define MAX_PASSES      16
+
 static int      pass = 1;
-static int      maxpass = 2;
+static int      minpass = 2;
+static int      final = FALSE;
+static int      stable = TRUE;
+static char     unstable_label[64];
 
 /* ---------------------------------------- INTERFACES
 */
@@ -44,22 +53,61 @@ static int      maxpass = 2;
 void ClearState(void)
 {
     pass = 1;
+    final = FALSE;
+    stable = TRUE;
+    unstable_label[0] = 0;
 }
 
 
-void NextPass(void)
+int NextPass(void)
 {
-    if (pass < maxpass)
+    if (!final)
     {
+        /* The final pass has to follow a stable one, so if there's only
+           room for the final pass left the values never settled
+        */
+        if (!stable && pass + 1 >= MAX_PASSES)
+        {
+            return FALSE;
+        }
+
         ClearMemoryWriteMarkers();
         pass++;
+        final = stable && pass >= minpass;
+        stable = TRUE;
+        unstable_label[0] = 0;
+    }
+
+    return TRUE;
+}
+
+
+void PassUnstable(const char *label)
+{
+    stable = FALSE;
+
+    if (label && !unstable_label[0])
+    {
+        CopyStr(unstable_label, label, sizeof unstable_label);
     }
 }
 
 
+const char *PassUnstableLabel(void)
+{
+    return unstable_label[0] ? unstable_label : NULL;
+}
+
+
+int MaxPasses(void)
+{
+    return MAX_PASSES;
+}
+
+
 int IsFinalPass(void)
 {
-    return pass == maxpass;
+    return final;
 }
 
 
@@ -71,7 +119,7 @@ int IsFirstPass(void)
 
 int IsIntermediatePass(void)
 {
-    return pass > 1 && pass < maxpass;
+    return pass > 1 && !final;
 }
 
 
@@ -79,7 +127,7 @@ void SetNeededPasses(int n)
 {
     if (!IsFinalPass())
     {
-        maxpass = n;
+        minpass = n;
     }
 }
 
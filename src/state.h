@@ -34,9 +34,30 @@
 void    ClearState(void);
 
 
-/* Move onto the next pass
+/* Move onto the next pass.  This is the final pass if the last one was stable
+   and enough passes have been run.  Returns FALSE if values still haven't
+   settled by the time only the final pass would be left, in which case
+   there's no output that can be trusted.
 */
-void    NextPass(void);
+int     NextPass(void);
+
+
+/* Flags that a value used in this pass may have been wrong, so another pass
+   is needed before the final one.  label is the label whose value was wrong,
+   or NULL if there isn't one.
+*/
+void    PassUnstable(const char *label);
+
+
+/* Get the first label passed to PassUnstable() in the current pass, or NULL
+   if there wasn't one.
+*/
+const char *PassUnstableLabel(void);
+
+
+/* Get the most passes that will be run
+*/
+int     MaxPasses(void);
 
 
 /* Is final pass?
@@ -54,7 +75,8 @@ int     IsFirstPass(void);
 int     IsIntermediatePass(void);
 
 
-/* Set number of passes needed.  This works while IsFinalPass() returns FALSE.
+/* Set the minimum number of passes needed.  This works while IsFinalPass()
+   returns FALSE.
 */
 void    SetNeededPasses(int n);
 
@@ -0,0 +1,273 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Profiling statistics, as enabled with --stats.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+#include "stats.h"
+
+
+/* ---------------------------------------- TYPES
+*/
+
+/* Enough for the load and output times and a time and line count for each
+   of the maximum number of passes.
+*/
+#define MAX_VALUES      64
+#define MAX_PEAKS       16
+
+typedef struct
+{
+    char        name[32];
+    double      value;
+    int         is_number;
+} StatsEntry;
+
+
+/* ---------------------------------------- GLOBALS
+*/
+CASM_THREAD_LOCAL int   stats_enabled = FALSE;
+
+static int              json;
+
+static StatsCounter     *head;
+static StatsCounter     *tail;
+
+static StatsEntry       value[MAX_VALUES];
+static int              no_values;
+
+static StatsEntry       peak[MAX_PEAKS];
+static int              no_peaks;
+
+
+/* ---------------------------------------- PRIVATE FUNCTIONS
+*/
+static void AddValue(const char *name, double v, int is_number)
+{
+    if (!json)
+    {
+        if (is_number)
+        {
+            fprintf(stderr, "stats: %s %ld\n", name, (long)v);
+        }
+        else
+        {
+            fprintf(stderr, "stats: %s %.6f\n", name, v);
+        }
+    }
+    else if (no_values < MAX_VALUES)
+    {
+        CopyStr(value[no_values].name, name, sizeof value[no_values].name);
+        value[no_values].value = v;
+        value[no_values].is_number = is_number;
+        no_values++;
+    }
+}
+
+
+static void ReportText(void)
+{
+    StatsCounter *c;
+    int f;
+
+    for(c = head; c; c = c->next)
+    {
+        if (c->timed)
+        {
+            fprintf(stderr, "stats: call %s %lu %.6f\n",
+                                c->name, c->calls, c->seconds);
+        }
+        else
+        {
+            fprintf(stderr, "stats: count %s %lu\n", c->name, c->calls);
+        }
+    }
+
+    for(f = 0; f < no_peaks; f++)
+    {
+        fprintf(stderr, "stats: peak %s %ld\n",
+                            peak[f].name, (long)peak[f].value);
+    }
+}
+
+
+static void ReportJSON(void)
+{
+    StatsCounter *c;
+    int f;
+
+    fprintf(stderr, "{\"values\": {");
+
+    for(f = 0; f < no_values; f++)
+    {
+        fprintf(stderr, "%s\"%s\": ", f ? ", " : "", value[f].name);
+
+        if (value[f].is_number)
+        {
+            fprintf(stderr, "%ld", (long)value[f].value);
+        }
+        else
+        {
+            fprintf(stderr, "%.6f", value[f].value);
+        }
+    }
+
+    fprintf(stderr, "}, \"calls\": {");
+
+    for(c = head; c; c = c->next)
+    {
+        fprintf(stderr, "%s\"%s\": {\"calls\": %lu",
+                            c == head ? "" : ", ", c->name, c->calls);
+
+        if (c->timed)
+        {
+            fprintf(stderr, ", \"seconds\": %.6f", c->seconds);
+        }
+
+        fprintf(stderr, "}");
+    }
+
+    fprintf(stderr, "}, \"peaks\": {");
+
+    for(f = 0; f < no_peaks; f++)
+    {
+        fprintf(stderr, "%s\"%s\": %ld", f ? ", " : "",
+                            peak[f].name, (long)peak[f].value);
+    }
+
+    fprintf(stderr, "}}\n");
+}
+
+
+/* ---------------------------------------- INTERFACES
+*/
+void StatsEnable(int as_json)
+{
+    stats_enabled = TRUE;
+    json = as_json;
+}
+
+
+double StatsTime(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void StatsAdd(StatsCounter *c, double start)
+{
+    if (!c->added)
+    {
+        c->added = TRUE;
+        c->next = NULL;
+
+        if (tail)
+        {
+            tail->next = c;
+        }
+        else
+        {
+            head = c;
+        }
+
+        tail = c;
+    }
+
+    c->calls++;
+
+    if (start >= 0)
+    {
+        c->timed = TRUE;
+        c->seconds += StatsTime() - start;
+    }
+}
+
+
+void StatsValue(const char *name, double seconds)
+{
+    AddValue(name, seconds, FALSE);
+}
+
+
+void StatsNumber(const char *name, long v)
+{
+    AddValue(name, v, TRUE);
+}
+
+
+void StatsPeak(const char *name, long v)
+{
+    int f;
+
+    for(f = 0; f < no_peaks; f++)
+    {
+        if (strcmp(peak[f].name, name) == 0)
+        {
+            if (v > peak[f].value)
+            {
+                peak[f].value = v;
+            }
+
+            return;
+        }
+    }
+
+    if (no_peaks < MAX_PEAKS)
+    {
+        CopyStr(peak[no_peaks].name, name, sizeof peak[no_peaks].name);
+        peak[no_peaks].value = v;
+        peak[no_peaks].is_number = TRUE;
+        no_peaks++;
+    }
+}
+
+
+void StatsReport(void)
+{
+    if (!stats_enabled)
+    {
+        return;
+    }
+
+    if (json)
+    {
+        ReportJSON();
+    }
+    else
+    {
+        ReportText();
+    }
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
@@ -0,0 +1,130 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Profiling statistics, as enabled with --stats.
+
+*/
+
+#ifndef CASM_STATS_H
+#define CASM_STATS_H
+
+/* ---------------------------------------- TYPES
+*/
+
+/* A counter for calls to a function.  Counters are declared static where
+   they're used, and are added to the report the first time they're updated.
+*/
+typedef struct statscounter
+{
+    char                name[32];
+    unsigned long       calls;
+    double              seconds;
+    int                 timed;
+    int                 added;
+    struct statscounter *next;
+} StatsCounter;
+
+#define STATS_COUNTER(name)     {name}
+
+
+/* ---------------------------------------- MACROS
+*/
+
+/* Set while stats are being collected.  Only read through the macros below,
+   so that code being measured pays no more than a test of it otherwise.
+   Only the main thread collects stats.
+*/
+extern CASM_THREAD_LOCAL int    stats_enabled;
+
+/* Count a call to counter c
+*/
+#define STATS_COUNT(c)                                                  \
+do                                                                      \
+{                                                                       \
+    if (stats_enabled) StatsAdd(&(c), -1);                              \
+} while(0)
+
+/* Time a call, with a double to hold the start time
+*/
+#define STATS_START(start)                                              \
+do                                                                      \
+{                                                                       \
+    if (stats_enabled) (start) = StatsTime();                           \
+} while(0)
+
+#define STATS_END(c, start)                                             \
+do                                                                      \
+{                                                                       \
+    if (stats_enabled) StatsAdd(&(c), (start));                         \
+} while(0)
+
+
+/* Record a size, keeping the largest
+*/
+#define STATS_PEAK(name, value)                                         \
+do                                                                      \
+{                                                                       \
+    if (stats_enabled) StatsPeak((name), (value));                      \
+} while(0)
+
+
+/* ---------------------------------------- INTERFACES
+*/
+
+/* Enable stats.  If json is TRUE then everything is held back and printed
+   as a single JSON object by StatsReport(), otherwise values are printed to
+   stderr as they're recorded.
+*/
+void    StatsEnable(int json);
+
+
+/* Get a time in seconds.  Only differences are meaningful.
+*/
+double  StatsTime(void);
+
+
+/* Add a call to a counter.  If start is not negative the call is timed from
+   then until now.
+*/
+void    StatsAdd(StatsCounter *c, double start);
+
+
+/* Record a time in seconds, or a count.  Printed as "stats: <name> <value>"
+   so the output is easy for scripts to read.
+*/
+void    StatsValue(const char *name, double seconds);
+void    StatsNumber(const char *name, long value);
+
+
+/* Record a size, keeping the largest seen under each name.
+*/
+void    StatsPeak(const char *name, long value);
+
+
+/* Print the counters and peaks.  Does nothing if stats aren't enabled.
+*/
+void    StatsReport(void);
+
+#endif
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
@@ -237,11 +237,8 @@ int T64Output(const char *filename, const char *filename_bank,
     */
     for(f = 0; f < count; f++)
     {
-        Byte *mem;
         int min, max, len;
 
-        mem = MemoryGetBlock(banks[f], 0, 0x10000);
-
         min = GetLowWriteMarker(banks[f]);
         max = GetHighWriteMarker(banks[f]);
 
@@ -250,8 +247,9 @@ int T64Output(const char *filename, const char *filename_bank,
         */
         if (f == 0)
         {
+            Byte basic[32];
             char sys[16];
-            int a = 0x803;
+            int a = 2;
             int next;
 
 	    if (options.start_addr == -1)
@@ -263,25 +261,27 @@ int T64Output(const char *filename, const char *filename_bank,
 		snprintf(sys, sizeof sys, "%d", options.start_addr);
 	    }
 
-            a = PokeW(mem, a, 10);
-            a = PokeB(mem, a, 0x9e);
-            a = PokeS(mem, a, sys);
-            a = PokeB(mem, a, 0x00);
+            /* The BASIC is built in a buffer holding the memory from 0x801
+            */
+            a = PokeW(basic, a, 10);
+            a = PokeB(basic, a, 0x9e);
+            a = PokeS(basic, a, sys);
+            a = PokeB(basic, a, 0x00);
+
+            next = 0x801 + a;
 
-            next = a;
+            a = PokeW(basic, a, 0x00);
 
-            a = PokeW(mem, a, 0x00);
+            PokeW(basic, 0, next);
 
-            PokeW(mem, 0x801, next);
+            MemoryWriteBlock(banks[f], 0x801, basic, a);
 
             min = 0x801;
         }
 
         len = max - min + 1;
 
-        fwrite(mem + min, len, 1, fp);
-
-        free(mem);
+        MemoryWriteFile(fp, banks[f], min, len);
     }
 
     fclose(fp);
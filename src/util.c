@@ -28,6 +28,7 @@
 #include <ctype.h>
 
 #include "global.h"
+#include "stats.h"
 #include "util.h"
 
 
@@ -46,8 +47,11 @@ char *DupStr(const char *p)
 
 void *Malloc(size_t len)
 {
+    static StatsCounter stats = STATS_COUNTER("Malloc");
     void *new;
 
+    STATS_COUNT(stats);
+
     if (!(new = malloc(len)))
     {
         fprintf(stderr, "Unable to allocate %lu bytes\n", (unsigned long)len);
@@ -60,8 +64,11 @@ void *Malloc(size_t len)
 
 void *Realloc(void *p, size_t len)
 {
+    static StatsCounter stats = STATS_COUNTER("Realloc");
     void *new;
 
+    STATS_COUNT(stats);
+
     if (!(new = realloc(p, len)))
     {
         fprintf(stderr, "Unable to reallocate %lu bytes\n", (unsigned long)len);
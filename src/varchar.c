@@ -134,12 +134,10 @@ void VarcharClear(Varchar *str)
 {
     if (str->data)
     {
-        free(str->data);
+        str->data[0] = 0;
     }
 
     str->len = 0;
-    str->size = 0;
-    str->data = NULL;
 }
 
 void VarcharFree(Varchar *str)
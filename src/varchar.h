@@ -63,7 +63,8 @@ const char *VarcharContents(Varchar *str);
 char *VarcharTransfer(Varchar *str);
 
 
-/* Clear a Varchar back to an empty string.
+/* Clear a Varchar back to an empty string.  The buffer is kept, so a
+   cleared Varchar can be refilled without reallocating.
 */
 void VarcharClear(Varchar *str);
 
@@ -0,0 +1,523 @@
+/*
+
+    casm - Simple, portable assembler
+
+    Copyright (C) 2003-2026  Ian Cowburn (ianc@noddybox.co.uk)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    -------------------------------------------------------------------------
+
+    Throughput benchmark.  Generates synthetic sources in output/bench,
+    assembles each with casm --stats and prints one JSON object per line with
+    the timings and peak memory use.
+
+    Unlike casm itself this needs a POSIX system, as it uses fork() and
+    wait4() to measure the assembler.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define DIR             "output/bench"
+#define MAX_PASSES      16
+
+
+/* ---------------------------------------- SOURCE GENERATION
+*/
+static FILE *src;
+static long src_lines;
+
+
+static void Open(const char *name)
+{
+    char path[256];
+
+    snprintf(path, sizeof path, DIR "/%s.asm", name);
+
+    if (!(src = fopen(path, "w")))
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    src_lines = 0;
+}
+
+
+static void Line(const char *fmt, ...)
+{
+    va_list va;
+
+    va_start(va, fmt);
+    vfprintf(src, fmt, va);
+    va_end(va);
+
+    fputc('\n', src);
+    src_lines++;
+}
+
+
+static long Close(void)
+{
+    fclose(src);
+    return src_lines;
+}
+
+
+/* 100k lines of Z80 with 10k global labels, each with a local, and a mix of
+   forward and backward references.
+*/
+static long GenZ80(void)
+{
+    int groups = 10000;
+    int f;
+
+    Open("z80");
+
+    Line("    cpu z80");
+    Line("    option output-file," DIR "/z80.bin");
+    Line("    option output-bank," DIR "/z80.%%u");
+
+    for(f = 0; f < groups; f++)
+    {
+        if (f % 2000 == 0)
+        {
+            Line("    bank %d", f / 2000);
+            Line("    org 0");
+        }
+
+        Line("g%d: ld a,%d", f, f & 0xff);
+        Line("    ld hl,g%d", f + 1 < groups ? f + 1 : 0);
+        Line("    ld (ix+%d),a", f % 100);
+        Line("    add a,b");
+        Line("    jp nz,g%d", (f * 7) % groups);
+        Line(".l%d inc hl", f);
+        Line("    djnz l%d", f);
+        Line("    call g%d", f / 2);
+        Line("    ex de,hl");
+        Line("    ldir");
+    }
+
+    return Close();
+}
+
+
+/* 100k lines of 6502 with 10k global labels, and zero page addresses that
+   are only known after they are used.
+*/
+static long Gen6502(void)
+{
+    int groups = 10000;
+    int f;
+
+    Open("6502");
+
+    Line("    cpu 6502");
+    Line("    option output-file," DIR "/6502.bin");
+    Line("    option output-bank," DIR "/6502.%%u");
+
+    for(f = 0; f < 64; f++)
+    {
+        Line("zp%d equ $%x", f, 0x10 + f);
+    }
+
+    for(f = 0; f < groups; f++)
+    {
+        if (f % 2000 == 0)
+        {
+            Line("    bank %d", f / 2000);
+            Line("    org $1000");
+        }
+
+        Line("g%d: lda #%d", f, f & 0xff);
+        Line("    sta zp%d", f % 64);
+        Line("    lda g%d", f + 1 < groups ? f + 1 : 0);
+        Line("    ldx fz%d", f % 64);
+        Line("    sta $0200,x");
+        Line(".l%d dey", f);
+        Line("    bne l%d", f);
+        Line("    jsr g%d", f / 2);
+        Line("    jmp g%d", (f * 7) % groups);
+        Line("    inc zp%d", (f * 3) % 64);
+    }
+
+    for(f = 0; f < 64; f++)
+    {
+        Line("fz%d equ $%x", f, 0x80 + f);
+    }
+
+    return Close();
+}
+
+
+/* 10k constants and 10k data labels, referenced in a scattered order
+*/
+static long GenLabels(void)
+{
+    int count = 10000;
+    int f;
+
+    Open("labels");
+
+    Line("    cpu z80");
+    Line("    option output-file," DIR "/labels.bin");
+    Line("    option output-bank," DIR "/labels.%%u");
+
+    for(f = 0; f < count; f++)
+    {
+        Line("s%d equ %d", f, f * 3);
+    }
+
+    Line("    org 0");
+
+    for(f = 0; f < count; f++)
+    {
+        Line("    dw s%d+s%d,d%d", (f * 7919) % count, f, (f * 104729) % count);
+    }
+
+    Line("    bank 100");
+    Line("    org 0");
+
+    for(f = 0; f < count; f++)
+    {
+        Line("d%d: db %d", f, f & 0xff);
+    }
+
+    return Close();
+}
+
+
+/* Macros nested 12 deep, each level playing the one below twice
+*/
+static long GenMacros(void)
+{
+    int depth = 12;
+    int f;
+
+    Open("macros");
+
+    Line("    cpu z80");
+    Line("    option output-file," DIR "/macros.bin");
+
+    Line("m0: macro");
+    Line(".lp ld a,\\1");
+    Line("    djnz lp");
+    Line("    endm");
+
+    for(f = 1; f < depth; f++)
+    {
+        Line("m%d: macro", f);
+        Line("    m%d \\1+1", f - 1);
+        Line("    m%d \\1+2", f - 1);
+        Line("    endm");
+    }
+
+    for(f = 0; f < 4; f++)
+    {
+        Line("    org 0");
+        Line("    m%d %d", depth - 1, f);
+    }
+
+    return Close();
+}
+
+
+/* A 48K file included into 64 banks, each filled up with DS
+*/
+static long GenIncbin(void)
+{
+    FILE *fp;
+    unsigned long seed = 1;
+    int f;
+
+    if (!(fp = fopen(DIR "/blob.bin", "wb")))
+    {
+        fprintf(stderr, "Failed to create blob.bin: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for(f = 0; f < 0xc000; f++)
+    {
+        seed = seed * 1103515245 + 12345;
+        fputc((seed >> 16) & 0xff, fp);
+    }
+
+    fclose(fp);
+
+    Open("incbin");
+
+    Line("    cpu z80");
+    Line("    option output-file," DIR "/incbin.bin");
+    Line("    option output-bank," DIR "/incbin.%%u");
+
+    for(f = 0; f < 64; f++)
+    {
+        Line("    bank %d", f);
+        Line("    org 0");
+        Line("    incbin " DIR "/blob.bin");
+        Line("    ds $3c00,$ea");
+        Line("    ds $400,{$ & $ff}");
+    }
+
+    return Close();
+}
+
+
+/* A 32 bank LoROM SNES image
+*/
+static long GenSNES(void)
+{
+    int f;
+    int r;
+
+    Open("snes");
+
+    Line("    processor 65c816");
+    Line("    option output-file," DIR "/snes.sfc");
+    Line("    option output-format,snes");
+    Line("    option snes-irq,vbl,g0");
+
+    for(f = 0; f < 32; f++)
+    {
+        Line("    bank %d", f);
+        Line("    org $8000");
+
+        for(r = 0; r < 400; r++)
+        {
+            int g = f * 400 + r;
+
+            Line("g%d: lda #$%x", g, g & 0xff);
+            Line("    sta $2100");
+            Line("    stz $2101");
+            Line("    ldx #%d", r & 0xff);
+            Line(".l%d dex", g);
+            Line("    bne l%d", g);
+            Line("    jsr g%d", f * 400 + r / 2);
+            Line("    jmp g%d", f * 400 + (r * 7) % 400);
+        }
+    }
+
+    return Close();
+}
+
+
+/* A NES image with 8 code banks and 8 character banks
+*/
+static long GenNES(void)
+{
+    int f;
+    int r;
+
+    Open("nes");
+
+    Line("    cpu 6502");
+    Line("    option output-file," DIR "/nes.nes");
+    Line("    option output-format,nes");
+    Line("    option nes-vector,reset,g0");
+    Line("    option nes-vector,nmi,g0");
+
+    for(f = 0; f < 8; f++)
+    {
+        Line("    bank %d", f);
+        Line("    org $8000");
+
+        for(r = 0; r < 1200; r++)
+        {
+            int g = f * 1200 + r;
+
+            Line("g%d: lda #%d", g, g & 0xff);
+            Line("    sta $2007");
+            Line("    ldx $%x", r & 0xff);
+            Line(".l%d dex", g);
+            Line("    bne l%d", g);
+            Line("    jsr g%d", f * 1200 + r / 2);
+        }
+    }
+
+    for(f = 0; f < 8; f++)
+    {
+        Line("    bank %d", f + 8);
+        Line("    org 0");
+        Line("    ds $2000,%d", f);
+    }
+
+    return Close();
+}
+
+
+/* ---------------------------------------- MEASUREMENT
+*/
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void Run(const char *casm, const char *name, long lines)
+{
+    char path[256];
+    char stats[256];
+    char buff[256];
+    double pass_time[MAX_PASSES];
+    double start;
+    double total;
+    struct rusage ru;
+    long lines_run = 0;
+    int passes = 0;
+    int status;
+    pid_t pid;
+    FILE *fp;
+    int f;
+
+    snprintf(path, sizeof path, DIR "/%s.asm", name);
+    snprintf(stats, sizeof stats, DIR "/%s.stats", name);
+
+    start = Now();
+
+    if ((pid = fork()) == 0)
+    {
+        int out = open("/dev/null", O_WRONLY);
+        int err = open(stats, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+
+        execl(casm, casm, "--stats", path, (char *)NULL);
+        _exit(127);
+    }
+
+    if (pid == -1 || wait4(pid, &status, 0, &ru) == -1)
+    {
+        fprintf(stderr, "Failed to run %s: %s\n", casm, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    total = Now() - start;
+
+    /* Pick the pass times out of casm's stats
+    */
+    if ((fp = fopen(stats, "r")))
+    {
+        while(fgets(buff, sizeof buff, fp))
+        {
+            int pass;
+            double t;
+            long n;
+
+            if (sscanf(buff, "stats: pass %d %lf", &pass, &t) == 2 &&
+                    passes < MAX_PASSES)
+            {
+                pass_time[passes++] = t;
+            }
+            else if (sscanf(buff, "stats: lines %d %ld", &pass, &n) == 2)
+            {
+                lines_run += n;
+            }
+        }
+
+        fclose(fp);
+    }
+
+    /* lines is the size of the source, lines_run how many lines the passes
+       ran in total, including macro expansions.  ru_maxrss is in kilobytes
+       on Linux and the BSDs, but bytes on macOS.
+    */
+    printf("{\"name\": \"%s\", \"status\": %d, \"lines\": %ld, "
+           "\"lines_run\": %ld, \"seconds\": %.6f, \"lines_per_sec\": %.0f, "
+           "\"passes\": %d, \"pass_seconds\": [",
+                name, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                lines, lines_run, total,
+                total > 0 ? lines_run / total : 0.0, passes);
+
+    for(f = 0; f < passes; f++)
+    {
+        printf("%s%.6f", f ? ", " : "", pass_time[f]);
+    }
+
+    printf("], \"peak_rss_kb\": %ld}\n", (long)ru.ru_maxrss);
+    fflush(stdout);
+}
+
+
+/* ---------------------------------------- MAIN
+*/
+static const struct
+{
+    const char  *name;
+    long        (*generate)(void);
+} bench[] =
+{
+    {"z80",     GenZ80},
+    {"6502",    Gen6502},
+    {"labels",  GenLabels},
+    {"macros",  GenMacros},
+    {"incbin",  GenIncbin},
+    {"snes",    GenSNES},
+    {"nes",     GenNES},
+    {NULL}
+};
+
+
+int main(int argc, char *argv[])
+{
+    int f;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: benchmark casm [name ...]\n");
+        return EXIT_FAILURE;
+    }
+
+    mkdir("output", 0755);
+    mkdir(DIR, 0755);
+
+    for(f = 0; bench[f].name; f++)
+    {
+        int run = (argc == 2);
+        int r;
+
+        for(r = 2; r < argc; r++)
+        {
+            run |= (strcmp(argv[r], bench[f].name) == 0);
+        }
+
+        if (run)
+        {
+            Run(argv[1], bench[f].name, bench[f].generate());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+/*
+vim: ai sw=4 ts=8 expandtab
+*/
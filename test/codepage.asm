@@ -0,0 +1,21 @@
+    ; Single characters in quotes are converted with the codepage selected
+    ; when the line is run, not the one in use when the source was read.
+    ;
+    option output-file,output/codepage.hex
+    option output-format,hex
+    option codepage,zx81
+    cpu z80
+    org $4000
+
+    db  "A",'B',"z"
+    db  "HELLO"
+    ld  a,"A"
+    ld  bc,'0'
+    cp  "9"
+
+chr macro
+    db  @1
+    endm
+
+    chr "C"
+    chr '1'
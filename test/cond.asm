@@ -0,0 +1,107 @@
+    ; Conditional assembly - nesting, elseif chains, ifdef/ifndef, branches
+    ; decided by labels set later in the source, and conditionals in macros
+    ; and repeated blocks.
+    ;
+    option output-file,output/cond.hex
+    option output-format,hex
+    cpu z80
+    org $8000
+
+VARIANT equ 2
+
+    ; Guarded twice, so only assembled once
+    ;
+    ifndef GUARD
+GUARD equ 1
+    db  $aa
+    endif
+
+    ifndef GUARD
+GUARD equ 2
+    db  $bb
+    endif
+
+    ; elseif chain, with nesting in the branch taken and in those skipped
+    ;
+    if VARIANT == 1
+    db  $01
+      if 1
+      db $ee
+      endif
+    elseif VARIANT == 2
+    db  $02
+      if 0
+      db $ee
+        if 1
+        db $ef
+        endif
+      elseif 0
+      db $ee
+      else
+      db $22
+      endif
+    elseif VARIANT == 2
+    db  $ee
+    else
+    db  $03
+    endif
+
+    .if VARIANT != 2
+    db  $ee
+    .else
+    db  $04
+    .endif
+
+    ; Decided by a label set later, so the first pass goes the other way
+    ;
+    if LATE > 10
+    db  $10
+    else
+    db  $20
+    endif
+    jp  target
+
+    ; Only labels set earlier in the pass count
+    ;
+    ifdef LATE
+    db  $ee
+    endif
+
+    ifdef VARIANT
+    db  $30
+    endif
+
+    ; Anything at all can be skipped
+    ;
+    if 0
+    macro
+    nonsense 1,2,3
+    endif
+
+odd macro
+    if @1 & 1
+    db  $41
+    else
+    db  $40
+    endif
+    endm
+
+    odd 1
+    odd 2
+
+    rept 3
+    if 1
+    db  $50
+    endif
+    endr
+
+    irp n,1,2,3
+    if @n == 2
+    db  $60
+    endif
+    endr
+
+target:
+    nop
+
+LATE equ 20
@@ -0,0 +1,21 @@
+    ; A branch that changes the accumulator size on some passes but not
+    ; others.  The size of the lda instructions after it changes with it, so
+    ; what was worked out for them on an earlier pass can't be reused.
+    ;
+    option output-file,output/cond_65c816.hex
+    option output-format,hex
+    cpu 65c816
+    org $8000
+
+    if WIDE
+    option +a16
+    endif
+
+    lda #1
+    lda #2
+    jmp target
+    nop
+target:
+    rts
+
+WIDE equ 1
@@ -0,0 +1,6 @@
+    ; Errors in an elseif that's tested are reported
+    ;
+    org 0
+    if 0
+    elseif 1+
+    endif
@@ -0,0 +1,4 @@
+    ; else without an if
+    ;
+    org 0
+    else
@@ -0,0 +1,9 @@
+    ; An if started outside a macro can't be ended in one
+    ;
+    org 0
+m macro
+    endif
+    endm
+    if 1
+    m
+    endif
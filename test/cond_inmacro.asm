@@ -0,0 +1,7 @@
+    ; An if started in a macro has to end in it
+    ;
+    org 0
+m macro
+    if 1
+    endm
+    m
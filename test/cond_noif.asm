@@ -0,0 +1,4 @@
+    ; endif without an if
+    ;
+    org 0
+    endif
@@ -0,0 +1,7 @@
+    ; A second else for the same if
+    ;
+    org 0
+    if 1
+    else
+    else
+    endif
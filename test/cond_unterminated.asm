@@ -0,0 +1,5 @@
+    ; if without an endif
+    ;
+    org 0
+    if 1
+    nop
@@ -0,0 +1,37 @@
+    ; Including files - include once, files that say they're only included
+    ; once, and the same file reached by different paths.  Paths are relative
+    ; to the directory casm is run in.
+    ;
+    option output-file,output/include.hex
+    option output-format,hex
+    cpu z80
+    org $8000
+
+    ; Included once, however it's reached
+    ;
+    include "include/data.asm", once
+    include "include/data.asm", once
+    include "include/../include/data.asm", once
+    include "./include/data.asm", once
+
+    ; Included again without once, so assembled again
+    ;
+    include "include/data.asm"
+
+    ; The file says it's only included once
+    ;
+    include "include/once.asm"
+    include "include/once.asm"
+    include "./include/once.asm"
+    .include "include/../include/once.asm"
+
+    ; Labels from a file included once are still there
+    ;
+    dw  onceword
+
+    ; Includes within includes, each included once
+    ;
+    include "include/outer.asm"
+    include "include/inner.asm"
+
+    db  $ff
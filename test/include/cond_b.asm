@@ -0,0 +1,3 @@
+    ; Included by include_cond.asm
+    ;
+    db  $bb
@@ -0,0 +1,4 @@
+    ; Included by include_cond.asm, and only ever included once
+    ;
+    once
+    db  $cc
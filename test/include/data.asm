@@ -0,0 +1,3 @@
+    ; Included by include.asm, once and not
+    ;
+    db  $11, $22
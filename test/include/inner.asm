@@ -0,0 +1,4 @@
+    ; Only ever included once
+    ;
+    .once
+    db  $66
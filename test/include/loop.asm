@@ -0,0 +1,4 @@
+    ; Included by include_recursive.asm, and includes itself through another
+    ;
+    db  1
+    include "include/loop2.asm"
@@ -0,0 +1,4 @@
+    ; Includes the file that included it
+    ;
+    db  2
+    include "./include/loop.asm"
@@ -0,0 +1,7 @@
+    ; Only ever included once, so including itself is skipped
+    ;
+    once
+
+onceword:
+    dw  $3344
+    include "include/once.asm"
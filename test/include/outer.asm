@@ -0,0 +1,5 @@
+    ; Includes inner.asm, which is only included once
+    ;
+    db  $55
+    include "include/inner.asm"
+    db  $77
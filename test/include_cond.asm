@@ -0,0 +1,44 @@
+    ; Includes in conditional blocks.  An include in a block that isn't run
+    ; doesn't count as the file's one inclusion, and a file that isn't there
+    ; is only an error if the include is run.
+    ;
+    option output-file,output/include_cond.hex
+    option output-format,hex
+    cpu z80
+    org $8000
+
+    ; Not run, so the include after it is the first
+    ;
+    if 0
+    include "include/cond_a.asm", once
+    endif
+
+    include "include/cond_a.asm", once
+    include "include/cond_a.asm", once
+
+    ; Only one branch is run, so only its file has been included
+    ;
+    if 1
+    include "include/cond_a.asm", once
+    else
+    include "include/cond_b.asm", once
+    endif
+
+    include "include/cond_b.asm", once
+
+    ; The file says it's only included once
+    ;
+    ifdef NOT_SET
+    include "include/cond_c.asm"
+    endif
+
+    include "include/cond_c.asm"
+    include "include/cond_c.asm"
+
+    ; An optional file that isn't there
+    ;
+    ifdef HAVE_EXTRA
+    include "include/missing_extra.asm"
+    endif
+
+    db  $ff
@@ -0,0 +1,7 @@
+    ; An optional file that isn't there, in a block that's run
+    ;
+    org 0
+    db  1
+    ifndef HAVE_EXTRA
+    include "include/missing_extra.asm"
+    endif
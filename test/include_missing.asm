@@ -0,0 +1,5 @@
+    ; A file that isn't there
+    ;
+    org 0
+    db  1
+    include "include/missing.asm"
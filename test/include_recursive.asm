@@ -0,0 +1,4 @@
+    ; A file that includes itself through another
+    ;
+    org 0
+    include "include/loop.asm"
@@ -0,0 +1,5 @@
+    ; A file that includes itself
+    ;
+    org 0
+    db  1
+    include "include_self.asm"
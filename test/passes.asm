@@ -0,0 +1,30 @@
+    ; Addressing modes chosen by labels set later, where each pass moves one
+    ; more label out of the zero page, so it takes eight passes to settle.
+    ; The lines that don't change in between are reused from the pass before.
+    ;
+    option output-file,output/passes.hex
+    option output-format,hex
+    cpu 6502
+    org $f2
+
+    lda l1
+    lda l2
+    lda l3
+    lda l4
+    lda l5
+l1: nop
+l2: nop
+l3: nop
+l4: nop
+l5: nop
+
+    ; Lines that read $ and labels that keep moving
+    ;
+back:
+    ldx #l5 & $ff
+    ldy #l5 >> 8
+    dex
+    bne back
+    jmp $+3
+    lda l5
+    lda back - l1
@@ -0,0 +1,67 @@
+    ; Repeated blocks - rept with a forward referenced count, nested blocks,
+    ; irp with plain and quoted items, local labels in a repeated block and
+    ; blocks inside macros.
+    ;
+    option output-file,output/rept.hex
+    option output-format,hex
+    cpu z80
+    org $8000
+
+    rept COUNT
+    db  $11
+    endr
+
+    rept 0
+    db  $ee
+    endr
+
+    ; Nested
+    ;
+    rept 2
+    db  $21
+    rept 3
+    db  $22
+    endr
+    endr
+
+    ; irp with numbers, quoted strings and quoted characters
+    ;
+    irp n,1,2,3
+    db  @n * 16
+    endr
+
+    irp s,"ab","cd"
+    db  @s
+    endr
+
+    irp c,'x',"y"
+    db  \1
+    endr
+
+    irp n
+    db  $ee
+    endr
+
+    ; Each time round gets its own local labels
+    ;
+    rept 2
+    ld  b,2
+.loop
+    djnz loop
+    jr  skip
+    nop
+.skip
+    endr
+
+    ; A rept in a macro uses the macro's arguments
+    ;
+fill macro
+    rept \1
+    db  \2
+    endr
+    endm
+
+    fill 2,$33
+    fill 3,$44
+
+COUNT equ 2
@@ -0,0 +1,6 @@
+    ; irp needs a valid argument name
+    ;
+    org 0
+    irp "a b",1,2
+    nop
+    endr
@@ -0,0 +1,7 @@
+    ; Global labels can't be set in a repeated block
+    ;
+    org 0
+    rept 2
+name:
+    nop
+    endr
@@ -0,0 +1,6 @@
+    ; rept needs a count
+    ;
+    org 0
+    rept
+    nop
+    endr
@@ -0,0 +1,5 @@
+    ; rept without an endr
+    ;
+    org 0
+    rept 2
+    nop
@@ -0,0 +1,5 @@
+    ; endr without a rept or irp
+    ;
+    org 0
+    nop
+    endr